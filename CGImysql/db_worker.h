@@ -0,0 +1,188 @@
+/**
+ * @file db_worker.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 数据库线程
+ * 只有需要访问数据库的路由才把请求交给数据库线程, 工作线程和子反应堆不再为每个请求取数据库连接;
+ * 数据库线程处理每个请求时从连接池取连接, 阻塞的查询只占用数据库线程;
+ * 取连接超过 acquire_timeout_ms 毫秒时以 NULL 调用 T::process_db, 由请求自行返回错误, 不在队列中越积越多
+ * 查询完成后由数据库线程调用 T::process_db 继续生成响应, 再注册写事件交回事件循环
+ * 开启合并提交时, 数据库线程取到可合并的请求(T::db_batchable)后最多再等 batch_wait_us 微秒,
+ * 把队列中其余可合并的请求一起交给 T::process_db_batch, 减少逐条提交的往返和事务开销
+ * @version 0.1
+ * @date 2023-03-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef DB_WORKER_H
+#define DB_WORKER_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include <exception>
+#include <list>
+#include <vector>
+
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+
+template <typename T>
+class db_worker {
+public:
+    // thread_number 为数据库线程数, 不应超过连接池的连接数
+    // max_requests 为队列中最多等待的请求数
+    // batch_wait_us 为合并提交时最长等待的微秒数, 为 0 时逐条处理; max_batch 为一次合并的最多请求数
+    // acquire_timeout_ms 为取连接的最长等待毫秒数, 为 -1 时一直等待
+    db_worker(
+        connection_pool* connPool, int thread_number = 1, int max_requests = 10000,
+        int batch_wait_us = 0, int max_batch = 32, int acquire_timeout_ms = -1);
+
+    ~db_worker();
+
+    // 把请求交给数据库线程, 队列已满时返回 false
+    bool append(T* request);
+
+private:
+    static void* worker(void* arg);
+
+    void run();
+
+    // 收集可合并的请求, 调用方持有队列锁, 返回时仍持有
+    int collect_batch(T** batch);
+
+private:
+    int              m_thread_number; // 数据库线程数
+    int              m_max_requests;  // 队列中允许的最大请求数
+    pthread_t*       m_threads;
+    std::list<T*>    m_queue;       // 等待查询的请求
+    locker           m_queuelocker; // 保护请求队列
+    sem              m_queuestat;   // 队列中的请求数
+    cond             m_arrived;     // 合并提交时等待新请求
+    int              m_batch_wait_us;
+    int              m_max_batch;
+    int              m_acquire_timeout_ms;
+    bool             m_stop;
+    connection_pool* m_connPool;
+};
+
+template <typename T>
+db_worker<T>::db_worker(
+    connection_pool* connPool, int thread_number, int max_requests, int batch_wait_us,
+    int max_batch, int acquire_timeout_ms)
+    : m_thread_number(thread_number)
+    , m_max_requests(max_requests)
+    , m_threads(NULL)
+    , m_batch_wait_us(batch_wait_us)
+    , m_max_batch(max_batch)
+    , m_acquire_timeout_ms(acquire_timeout_ms)
+    , m_stop(false)
+    , m_connPool(connPool) {
+
+    if (thread_number <= 0 || max_requests <= 0 || batch_wait_us < 0 || max_batch <= 0) {
+        throw std::exception();
+    }
+
+    m_threads = new pthread_t[m_thread_number];
+    for (int i = 0; i < m_thread_number; ++i) {
+        if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
+            delete[] m_threads;
+            throw std::exception();
+        }
+        if (pthread_detach(m_threads[i])) {
+            delete[] m_threads;
+            throw std::exception();
+        }
+    }
+}
+
+template <typename T>
+db_worker<T>::~db_worker() {
+    delete[] m_threads;
+    m_stop = true;
+}
+
+template <typename T>
+bool db_worker<T>::append(T* request) {
+    m_queuelocker.lock();
+    if ((int)m_queue.size() >= m_max_requests) {
+        m_queuelocker.unlock();
+        return false;
+    }
+    m_queue.push_back(request);
+    if (m_batch_wait_us > 0) {
+        m_arrived.signal();
+    }
+    m_queuelocker.unlock();
+    m_queuestat.post();
+    return true;
+}
+
+template <typename T>
+void* db_worker<T>::worker(void* arg) {
+    db_worker* pool = (db_worker*)arg;
+    pool->run();
+    return pool;
+}
+
+template <typename T>
+void db_worker<T>::run() {
+    std::vector<T*> batch(m_max_batch);
+
+    while (!m_stop) {
+        m_queuestat.wait();
+        m_queuelocker.lock();
+        if (m_queue.empty()) {
+            m_queuelocker.unlock();
+            continue;
+        }
+        T* request = m_queue.front();
+        m_queue.pop_front();
+
+        int count = 1;
+        batch[0] = request;
+        if (m_batch_wait_us > 0 && request->db_batchable()) {
+            count += collect_batch(&batch[1]);
+        }
+        m_queuelocker.unlock();
+
+        // 每批请求取一次连接, 处理完放回; 超时未取得时 mysql 为 NULL
+        MYSQL*         mysql = NULL;
+        connectionRAII mysqlcon(&mysql, m_connPool, m_acquire_timeout_ms);
+        if (count > 1) {
+            T::process_db_batch(mysql, &batch[0], count);
+        }
+        else {
+            request->process_db(mysql);
+        }
+    }
+}
+
+template <typename T>
+int db_worker<T>::collect_batch(T** batch) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)m_batch_wait_us * 1000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+
+    // 取出的请求对应的信号量不再扣减, 其他线程被多唤醒时发现队列为空会继续等待
+    int count = 0;
+    while (1) {
+        typename std::list<T*>::iterator it = m_queue.begin();
+        while (it != m_queue.end() && count < m_max_batch - 1) {
+            if ((*it)->db_batchable()) {
+                batch[count++] = *it;
+                it = m_queue.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if (count == m_max_batch - 1 || !m_arrived.timewait(m_queuelocker.get(), deadline)) {
+            return count;
+        }
+    }
+}
+
+#endif
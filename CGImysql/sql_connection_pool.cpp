@@ -10,7 +10,9 @@
  */
 #include "sql_connection_pool.h"
 
+#include <mysql/errmsg.h>
 #include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,11 +22,19 @@
 #include <list>
 #include <string>
 
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
 using namespace std;
 
 connection_pool::connection_pool() {
+    this->MaxConn = 0;
+    this->MinConn = 0;
     this->CurConn = 0;
     this->FreeConn = 0;
+    this->PendingConn = 0;
+    this->stop = true;
+    memset(&poolStats, 0, sizeof(poolStats));
 }
 
 connection_pool* connection_pool::GetInstance() {
@@ -33,67 +43,125 @@ connection_pool* connection_pool::GetInstance() {
 }
 
 void connection_pool::init(
-    string url, string User, string PassWord, string DBName, int Port, unsigned int MaxConn) {
+    string url, string User, string PassWord, string DBName, int Port, unsigned int MaxConn,
+    unsigned int MinConn) {
     // 初始化数据库信息
     this->url = url;
     this->Port = Port;
     this->User = User;
     this->PassWord = PassWord;
     this->DatabaseName = DBName;
+    this->MaxConn = MaxConn;
+    this->MinConn = MinConn < MaxConn ? MinConn : MaxConn;
 
-    lock.lock();
-
-    // 创建 MaxConn 条数据库连接
-    for (int i = 0; i < MaxConn; i++) {
-
-        // 初始化连接环境
-        MYSQL* con = NULL;
-        con = mysql_init(con);
-        if (con == NULL) {
-            cout << "Error:" << mysql_error(con);
-            exit(1);
-        }
-
-        // 连接 MySQL 服务器
-        con = mysql_real_connect(
-            con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
+    // 先建立 MinConn 条数据库连接, 其余在不够用时建立
+    for (unsigned int i = 0; i < this->MinConn; i++) {
+        MYSQL* con = Connect();
         if (con == NULL) {
-            cout << "Error: " << mysql_error(con);
+            cout << "Error: cannot connect to " << url << endl;
             exit(1);
         }
 
         // 当前连接加入连接池
-        connList.push_back(con);
+        lock.lock();
+        connList.push_back({con, time(NULL)});
         ++FreeConn; // 空闲连接数 +1
+        lock.unlock();
     }
 
-    // 信号量设置为初始化空闲数, 即最大连接数
-    reserve = sem(FreeConn);
+    // 启动检查线程
+    stop = false;
+    if (pthread_create(&checker, NULL, CheckWorker, this) != 0) {
+        stop = true;
+    }
+}
 
-    // 设置连接数
-    this->MaxConn = FreeConn;
+// 从 from 到现在经过的微秒数
+static long elapsed_us(const struct timespec& from) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from.tv_sec) * 1000000L + (now.tv_nsec - from.tv_nsec) / 1000;
+}
 
-    lock.unlock();
+// 当前时间之后 ms 毫秒的绝对时间, 用于条件变量超时等待
+static struct timespec deadline_after(long ms) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += ms / 1000;
+    t.tv_nsec += (ms % 1000) * 1000000L;
+    t.tv_sec += t.tv_nsec / 1000000000L;
+    t.tv_nsec %= 1000000000L;
+    return t;
 }
 
-MYSQL* connection_pool::GetConnection() {
-    MYSQL* con = NULL;
+static bool before(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
 
-    if (0 == connList.size()) {
-        return NULL;
+MYSQL* connection_pool::GetConnection(int timeout_ms) {
+    MYSQL*          con = NULL;
+    bool            waited = false;
+    struct timespec start, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (timeout_ms >= 0) {
+        deadline = deadline_after(timeout_ms);
     }
 
-    // 信号量 -1(原子), 为 0 时阻塞
-    reserve.wait();
-
     lock.lock();
+    while (connList.empty()) {
+        // 没有空闲连接且未达上限时新建, 建立连接时不持有锁
+        // 建立连接的超时不超过剩余的等待时间, 数据库无响应时不会阻塞 IO_TIMEOUT 秒;
+        // MySQL 的超时以秒为单位, 向上取整, 最多超出不到 1 秒
+        long left_ms = timeout_ms - elapsed_us(start) / 1000;
+        if (TotalConn() < MaxConn && (timeout_ms < 0 || left_ms > 0)) {
+            unsigned int connect_timeout = IO_TIMEOUT;
+            if (timeout_ms >= 0 && (left_ms + 999) / 1000 < IO_TIMEOUT) {
+                connect_timeout = (left_ms + 999) / 1000;
+            }
+            ++PendingConn;
+            lock.unlock();
+            con = Connect(connect_timeout);
+            lock.lock();
+            --PendingConn;
+            if (con) {
+                break;
+            }
+        }
 
-    // 连接池取出一个连接
-    con = connList.front();
-    connList.pop_front();
+        // 等待其他线程放回连接, 每秒醒来一次重试新建
+        struct timespec until = deadline_after(1000);
+        if (timeout_ms >= 0 && before(deadline, until)) {
+            until = deadline;
+        }
+        waited = true;
+        reserve.timewait(lock.get(), until);
+
+        if (connList.empty() && timeout_ms >= 0 && !before(deadline_after(0), deadline)) {
+            long us = elapsed_us(start);
+            ++poolStats.waits;
+            ++poolStats.timeouts;
+            poolStats.wait_us += us;
+            poolStats.max_wait_us = us > poolStats.max_wait_us ? us : poolStats.max_wait_us;
+            lock.unlock();
+            return NULL;
+        }
+    }
 
-    --FreeConn; // 空闲连接数 -1
-    ++CurConn;  // 当前已使用连接数 +1
+    // 连接池取出一个连接, 新建的连接不在空闲链表中
+    if (!con) {
+        con = connList.front().conn;
+        connList.pop_front();
+        --FreeConn; // 空闲连接数 -1
+    }
+    ++CurConn; // 当前已使用连接数 +1
+
+    ++poolStats.acquires;
+    if (waited) {
+        long us = elapsed_us(start);
+        ++poolStats.waits;
+        poolStats.wait_us += us;
+        poolStats.max_wait_us = us > poolStats.max_wait_us ? us : poolStats.max_wait_us;
+    }
 
     lock.unlock();
     return con;
@@ -106,45 +174,340 @@ bool connection_pool::ReleaseConnection(MYSQL* con) {
 
     lock.lock();
 
-    // 往连接池放回连接
-    connList.push_back(con);
+    // 连接已断开时不放回, 否则它总在表头被复用, 不会空闲到被检查线程 ping 出来
+    map<MYSQL*, statements>::iterator it = stmts.find(con);
+    if (it != stmts.end() && it->second.lost) {
+        --CurConn;
+        ++poolStats.dropped;
+        lock.unlock();
+        Close(con);
+
+        // 等待连接的线程可以新建连接了
+        reserve.signal();
+        return true;
+    }
+
+    // 往连接池放回连接, 放在表头, 空闲最久的连接留在表尾等待回收
+    connList.push_front({con, time(NULL)});
     ++FreeConn; // 空闲连接数 +1
     --CurConn;  // 当前已使用连接数 -1
 
     lock.unlock();
 
-    // 信号量 +1(原子)
-    reserve.post();
+    // 唤醒一个等待连接的线程
+    reserve.signal();
     return true;
 }
 
 void connection_pool::DestroyPool() {
+    // 先停止检查线程
+    lock.lock();
+    bool running = !stop;
+    stop = true;
+    stopped.signal();
+    lock.unlock();
+    if (running) {
+        pthread_join(checker, NULL);
+    }
+
+    // 关闭所有空闲连接, 使用中的连接由持有者放回
+    lock.lock();
+    list<idle_conn> idle;
+    idle.swap(connList);
+    FreeConn = 0; // 空闲连接数置 0
+    lock.unlock();
+
+    for (list<idle_conn>::iterator it = idle.begin(); it != idle.end(); ++it) {
+        Close(it->conn);
+    }
+}
+
+MYSQL* connection_pool::Connect(unsigned int connect_timeout) {
+    // 初始化连接环境
+    MYSQL* con = mysql_init(NULL);
+    if (con == NULL) {
+        return NULL;
+    }
+
+    // 数据库无响应时不让取连接和查询的线程一直阻塞
+    unsigned int timeout = IO_TIMEOUT;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+    mysql_options(con, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    mysql_options(con, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+
+    // 连接 MySQL 服务器
+    if (!mysql_real_connect(
+            con, url.c_str(), User.c_str(), PassWord.c_str(), DatabaseName.c_str(), Port, NULL,
+            0)) {
+        LOG_ERROR("connect error:%s", mysql_error(con));
+        mysql_close(con);
+        return NULL;
+    }
+
+    // 准备查询语句, 插入语句按行数在首次使用时准备
+    statements st;
+    memset(&st, 0, sizeof(st));
+    st.select_user = Prepare(con, "SELECT passwd FROM user WHERE username=?");
 
     lock.lock();
-    if (connList.size() > 0) {
-        list<MYSQL*>::iterator it;
-        // 迭代器遍历, 关闭所有数据库连接
-        for (it = connList.begin(); it != connList.end(); ++it) {
-            MYSQL* con = *it;
-            mysql_close(con); // 关闭 MySQL 实例
+    stmts[con] = st;
+    lock.unlock();
+    return con;
+}
+
+void connection_pool::Close(MYSQL* con) {
+    lock.lock();
+    statements                        st;
+    map<MYSQL*, statements>::iterator it = stmts.find(con);
+    bool                              found = it != stmts.end();
+    if (found) {
+        st = it->second;
+        stmts.erase(it);
+    }
+    lock.unlock();
+
+    // 先关闭连接上的语句
+    if (found) {
+        if (st.select_user) {
+            mysql_stmt_close(st.select_user);
+        }
+        for (int i = 0; i <= MAX_INSERT_ROWS; ++i) {
+            if (st.insert_user[i]) {
+                mysql_stmt_close(st.insert_user[i]);
+            }
         }
-        CurConn = 0;      // 当前已使用连接数置 0
-        FreeConn = 0;     // 空闲连接数置 0
-        connList.clear(); // 清空数据库连接池
+    }
+    mysql_close(con); // 关闭 MySQL 实例
+}
 
+void* connection_pool::CheckWorker(void* arg) {
+    connection_pool* pool = (connection_pool*)arg;
+    pool->lock.lock();
+    while (!pool->stop) {
+        pool->stopped.timewait(pool->lock.get(), deadline_after(CHECK_INTERVAL * 1000L));
+        if (pool->stop) {
+            break;
+        }
+        pool->lock.unlock();
+        pool->CheckIdle();
+        pool->lock.lock();
+    }
+    pool->lock.unlock();
+    return NULL;
+}
+
+void connection_pool::CheckIdle() {
+    time_t          now = time(NULL);
+    list<idle_conn> stale;  // 需要 ping 的连接
+    list<MYSQL*>    reaped; // 需要关闭的连接
+
+    // 从表尾开始取出空闲较久的连接, 检查期间不交给其他线程
+    lock.lock();
+    list<idle_conn>::iterator it = connList.end();
+    while (it != connList.begin()) {
+        --it;
+        if (now - it->since < CHECK_INTERVAL) {
+            break;
+        }
+        if (now - it->since >= IDLE_TIMEOUT && TotalConn() > MinConn) {
+            reaped.push_back(it->conn);
+        }
+        else {
+            stale.push_front(*it);
+            ++PendingConn;
+        }
+        --FreeConn;
+        it = connList.erase(it);
+    }
+    poolStats.reaped += reaped.size();
+    lock.unlock();
+
+    for (list<MYSQL*>::iterator r = reaped.begin(); r != reaped.end(); ++r) {
+        Close(*r);
+    }
+
+    // ping 失败的连接重新建立
+    for (list<idle_conn>::iterator c = stale.begin(); c != stale.end(); ++c) {
+        if (mysql_ping(c->conn) != 0) {
+            LOG_ERROR("ping error:%s", mysql_error(c->conn));
+            Close(c->conn);
+            c->conn = Connect();
+            c->since = now;
+            if (c->conn) {
+                lock.lock();
+                ++poolStats.reconnects;
+                lock.unlock();
+            }
+        }
+    }
+
+    // 放回表尾, 保持按放回时间排列; 重新建立失败的不再计入连接数
+    lock.lock();
+    for (list<idle_conn>::iterator c = stale.begin(); c != stale.end(); ++c) {
+        --PendingConn;
+        if (c->conn) {
+            connList.push_back(*c);
+            ++FreeConn;
+        }
+    }
+    unsigned int missing = MinConn > TotalConn() ? MinConn - TotalConn() : 0;
+    PendingConn += missing;
+    lock.unlock();
+
+    // 补足 MinConn 个连接
+    for (unsigned int i = 0; i < missing; ++i) {
+        MYSQL* con = Connect();
+        lock.lock();
+        --PendingConn;
+        if (con) {
+            connList.push_front({con, time(NULL)});
+            ++FreeConn;
+        }
         lock.unlock();
     }
+    reserve.broadcast();
+}
 
+connection_pool_stats connection_pool::stats() {
+    lock.lock();
+    connection_pool_stats s = poolStats;
+    s.total = TotalConn();
+    s.busy = CurConn;
+    poolStats.max_wait_us = 0;
     lock.unlock();
+    return s;
+}
+
+MYSQL_STMT* connection_pool::Prepare(MYSQL* conn, const string& sql) {
+    MYSQL_STMT* stmt = mysql_stmt_init(conn);
+    if (stmt && mysql_stmt_prepare(stmt, sql.c_str(), sql.size()) != 0) {
+        cout << "Error: " << mysql_stmt_error(stmt);
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+connection_pool::statements* connection_pool::GetStatements(MYSQL* conn) {
+    // 其他线程会增删连接, 查找时加锁; 取得的语句只由持有连接的线程使用
+    lock.lock();
+    map<MYSQL*, statements>::iterator it = stmts.find(conn);
+    statements*                       st = it == stmts.end() ? NULL : &it->second;
+    lock.unlock();
+    return st;
+}
+
+// 与服务器的连接已断开的错误码, 连接不能再使用
+static bool connection_lost(unsigned int err) {
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+void connection_pool::ReportError(MYSQL* conn, unsigned int err) {
+    statements* st = GetStatements(conn);
+    if (st && connection_lost(err)) {
+        st->lost = true;
+    }
+}
+
+// 绑定字符串参数或结果
+static void bind_string(
+    MYSQL_BIND* bind, const char* data, unsigned long* length, unsigned long capacity) {
+    memset(bind, 0, sizeof(*bind));
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = (void*)data;
+    bind->buffer_length = capacity;
+    bind->length = length;
+}
+
+int connection_pool::SelectUser(MYSQL* conn, std::string_view name, string& password) {
+    statements* st = GetStatements(conn);
+    if (!st || !st->select_user || name.size() > MAX_FIELD_LEN) {
+        return -1;
+    }
+    MYSQL_STMT* stmt = st->select_user;
+
+    // 用户名作为参数传入, 不拼接进 SQL
+    MYSQL_BIND    param;
+    unsigned long name_len = name.size();
+    bind_string(&param, name.data(), &name_len, name_len);
+
+    char          buf[MAX_FIELD_LEN + 1];
+    unsigned long buf_len = 0;
+    MYSQL_BIND    result;
+    bind_string(&result, buf, &buf_len, sizeof(buf));
+
+    if (mysql_stmt_bind_param(stmt, &param) || mysql_stmt_execute(stmt) ||
+        mysql_stmt_bind_result(stmt, &result) || mysql_stmt_store_result(stmt)) {
+        LOG_ERROR("SELECT error:%s", mysql_stmt_error(stmt));
+        st->lost = st->lost || connection_lost(mysql_stmt_errno(stmt));
+        return -1;
+    }
+    int ret = mysql_stmt_fetch(stmt);
+    mysql_stmt_free_result(stmt);
+    if (ret == MYSQL_NO_DATA) {
+        return 0;
+    }
+    if (ret != 0) {
+        LOG_ERROR("SELECT error:%s", mysql_stmt_error(stmt));
+        st->lost = st->lost || connection_lost(mysql_stmt_errno(stmt));
+        return -1;
+    }
+    password.assign(buf, buf_len < sizeof(buf) ? buf_len : sizeof(buf));
+    return 1;
+}
+
+int connection_pool::InsertUsers(
+    MYSQL* conn, const std::string_view* names, const std::string_view* passwords, int rows) {
+    statements* st = GetStatements(conn);
+    if (!st || rows <= 0 || rows > MAX_INSERT_ROWS) {
+        return -1;
+    }
+
+    MYSQL_STMT*& stmt = st->insert_user[rows];
+    if (!stmt) {
+        string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+        for (int i = 1; i < rows; ++i) {
+            sql += ",(?, ?)";
+        }
+        stmt = Prepare(conn, sql);
+        if (!stmt) {
+            return -1;
+        }
+    }
+
+    MYSQL_BIND    params[MAX_INSERT_ROWS * 2];
+    unsigned long lengths[MAX_INSERT_ROWS * 2];
+    for (int i = 0; i < rows; ++i) {
+        lengths[2 * i] = names[i].size();
+        lengths[2 * i + 1] = passwords[i].size();
+        bind_string(&params[2 * i], names[i].data(), &lengths[2 * i], lengths[2 * i]);
+        bind_string(
+            &params[2 * i + 1], passwords[i].data(), &lengths[2 * i + 1], lengths[2 * i + 1]);
+    }
+    if (mysql_stmt_bind_param(stmt, params)) {
+        LOG_ERROR("INSERT error:%s", mysql_stmt_error(stmt));
+        return -1;
+    }
+    if (mysql_stmt_execute(stmt)) {
+        if (mysql_stmt_errno(stmt) == ER_DUP_ENTRY) {
+            return 0;
+        }
+        LOG_ERROR("INSERT error:%s", mysql_stmt_error(stmt));
+        st->lost = st->lost || connection_lost(mysql_stmt_errno(stmt));
+        return -1;
+    }
+    return 1;
 }
 
 int connection_pool::GetFreeConn() { return this->FreeConn; }
 
 connection_pool::~connection_pool() { DestroyPool(); }
 
-connectionRAII::connectionRAII(MYSQL** SQL, connection_pool* connPool) {
-    // 从连接池获取一个连接
-    *SQL = connPool->GetConnection();
+connectionRAII::connectionRAII(MYSQL** SQL, connection_pool* connPool, int timeout_ms) {
+    // 从连接池获取一个连接, 记录等待时间
+    int64_t start = metrics::now_ns();
+    *SQL = connPool->GetConnection(timeout_ms);
+    metrics::record(metrics::DB_ACQUIRE, metrics::now_ns() - start);
     conRAII = *SQL;
     poolRAII = connPool;
 }
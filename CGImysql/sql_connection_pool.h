@@ -1,7 +1,9 @@
 /**
  * @file sql_connection_pool.h
  * @author Chang Chiang (Chang_Chiang@outlook.com.com)
- * @brief
+ * @brief 数据库连接池
+ * 启动时建立 MinConn 个连接, 不够用时按需增加到 MaxConn 个; 取连接可设置超时;
+ * 后台线程定期 ping 空闲连接, 失效的重新建立, 空闲过久且超过 MinConn 的关闭
  * @version 0.1
  * @date 2023-03-13
  *
@@ -16,57 +18,141 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <time.h>
+
 #include <iostream>
 #include <list>
+#include <map>
 #include <string>
+#include <string_view>
 
 #include "../lock/locker.h"
 
 using namespace std;
 
+// 连接池统计信息
+struct connection_pool_stats {
+    int  total;       // 已建立的连接数
+    int  busy;        // 使用中的连接数
+    long acquires;    // 取得连接的次数
+    long waits;       // 需要等待的次数
+    long timeouts;    // 等待超时的次数
+    long wait_us;     // 累计等待时间
+    long max_wait_us; // 两次取统计信息之间的最长等待时间
+    long reconnects;  // 心跳失败后重新建立的连接数
+    long reaped;      // 空闲过久被关闭的连接数
+    long dropped;     // 查询时发现已断开、放回时关闭的连接数
+};
+
 class connection_pool {
 public:
+    static const int MAX_INSERT_ROWS = 32; // 一条 INSERT 最多插入的用户数
+    static const int MAX_FIELD_LEN = 255;  // 用户名和密码的最大长度
+    static const int CHECK_INTERVAL = 10;  // 检查空闲连接的间隔秒数, 空闲不足该时长的不 ping
+    static const int IDLE_TIMEOUT = 60;    // 空闲超过该秒数且连接数多于 MinConn 时关闭
+    static const int IO_TIMEOUT = 5;       // 建立连接和读写的超时秒数
+
     // 获取数据库连接
     // 当有请求时, 从数据库连接池中返回一个可用连接, 更新使用和空闲连接数
-    MYSQL* GetConnection();
+    // 没有空闲连接且未达上限时新建连接; timeout_ms 为最长等待毫秒数, 超时返回 NULL, 为 -1 时一直等待
+    MYSQL* GetConnection(int timeout_ms = -1);
 
-    // 释放连接
+    // 释放连接, 查询时发现已断开的连接不再放回, 关闭后由取连接的线程按需重新建立
     bool ReleaseConnection(MYSQL* conn);
 
+    // 直接执行查询出错时调用, 错误码表示与服务器的连接已断开时, 放回时关闭该连接
+    // SelectUser 和 InsertUsers 出错时自行检查, 不需要调用
+    void ReportError(MYSQL* conn, unsigned int err);
+
     // 当前空闲的连接数
     int GetFreeConn();
 
+    // 取统计信息, 并把最长等待时间清零
+    connection_pool_stats stats();
+
     // 销毁数据库连接池
     void DestroyPool();
 
     // 单例模式
     static connection_pool* GetInstance();
 
-    // 初始化
+    // 按用户名查询密码, 使用连接上预先准备的语句
+    // 查到返回 1, 用户不存在返回 0, 出错返回 -1, 错误由 mysql_stmt_error 记录到日志
+    int SelectUser(MYSQL* conn, std::string_view name, string& password);
+
+    // 用一条多行 INSERT 插入 rows 个用户, 任一行失败时整条语句都不生效
+    // 每种行数的语句在该连接上首次使用时准备
+    // 成功返回 1, 违反用户名的唯一约束返回 0, 其他错误返回 -1 并记录到日志
+    int InsertUsers(
+        MYSQL* conn, const std::string_view* names, const std::string_view* passwords, int rows);
+
+    // 初始化, 建立 MinConn 个连接并启动检查线程
     void init(
         string url, string User, string PassWord, string DataBaseName, int Port,
-        unsigned int MaxConn);
+        unsigned int MaxConn, unsigned int MinConn = 1);
 
 private:
+    // 每个连接上预先准备的语句, 只由持有该连接的线程使用
+    struct statements {
+        MYSQL_STMT* select_user;                     // 按用户名查询密码
+        MYSQL_STMT* insert_user[MAX_INSERT_ROWS + 1]; // insert_user[n] 一次插入 n 行
+        bool        lost;                             // 连接已断开, 放回时关闭
+    };
+
+    // 空闲连接及其放回连接池的时间
+    struct idle_conn {
+        MYSQL* conn;
+        time_t since;
+    };
+
     // 构造函数
     connection_pool();
 
+    // 取得连接上的语句, 连接不属于连接池时返回 NULL
+    statements* GetStatements(MYSQL* conn);
+
+    static MYSQL_STMT* Prepare(MYSQL* conn, const string& sql);
+
+    // 建立连接并准备语句, 失败返回 NULL; 不持有锁时调用
+    // connect_timeout 为建立连接(包括握手)的超时秒数, 读写超时仍为 IO_TIMEOUT
+    MYSQL* Connect(unsigned int connect_timeout = IO_TIMEOUT);
+
+    // 关闭连接上的语句和连接; 不持有锁时调用
+    void Close(MYSQL* conn);
+
+    // 检查线程, 定期 ping 空闲连接、回收空闲过久的连接、补足 MinConn 个连接
+    static void* CheckWorker(void* arg);
+
+    void CheckIdle();
+
+    // 连接总数, 包括正在建立和正在检查的; 调用方持有锁
+    unsigned int TotalConn() const { return CurConn + FreeConn + PendingConn; }
+
     // 析构函数
     ~connection_pool();
 
 private:
-    unsigned int MaxConn;  // 最大连接数
-    unsigned int CurConn;  // 当前已使用的连接数
-    unsigned int FreeConn; // 当前空闲的连接数
+    unsigned int MaxConn;     // 最大连接数
+    unsigned int MinConn;     // 最少保持的连接数
+    unsigned int CurConn;     // 当前已使用的连接数
+    unsigned int FreeConn;    // 当前空闲的连接数
+    unsigned int PendingConn; // 正在建立或正在检查的连接数
 
 private:
-    locker       lock;     // 互斥锁
-    list<MYSQL*> connList; // 双向循环链表实现连接池
-    sem          reserve;  // 信号量
+    locker          lock;     // 互斥锁
+    list<idle_conn> connList; // 空闲连接, 表头为最近放回的
+    cond            reserve;  // 有连接放回时唤醒等待的线程
+
+    map<MYSQL*, statements> stmts; // 各连接上的语句
+
+    pthread_t             checker;   // 检查线程
+    cond                  stopped;   // 销毁连接池时唤醒检查线程
+    bool                  stop;      // 检查线程是否退出
+    connection_pool_stats poolStats; // 统计信息
 
 private:
     string url;          // 数据库主机地址
-    string Port;         // 数据库端口号
+    int    Port;         // 数据库端口号
     string User;         // 登陆数据库用户名
     string PassWord;     // 登陆数据库密码
     string DatabaseName; // 使用数据库名
@@ -77,8 +163,8 @@ class connectionRAII {
 
 public:
     // 构造函数
-    // 连接池中成员为指针, 故这里使用二级指针
-    connectionRAII(MYSQL** con, connection_pool* connPool);
+    // 连接池中成员为指针, 故这里使用二级指针; 超时未取得连接时 *con 为 NULL
+    connectionRAII(MYSQL** con, connection_pool* connPool, int timeout_ms = -1);
 
     // 析构函数
     ~connectionRAII();
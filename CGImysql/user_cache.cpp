@@ -0,0 +1,107 @@
+/**
+ * @file user_cache.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 按需加载的用户缓存
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "user_cache.h"
+
+#include <functional>
+
+user_cache::user_cache() {
+    for (int i = 0; i < SHARDS; ++i) {
+        m_shards[i].hits = 0;
+        m_shards[i].misses = 0;
+        m_shards[i].loads = 0;
+        m_shards[i].evictions = 0;
+    }
+}
+
+user_cache::~user_cache() {}
+
+user_cache* user_cache::get_instance() {
+    static user_cache instance;
+    return &instance;
+}
+
+user_cache::shard& user_cache::shard_of(std::string_view name) {
+    return m_shards[std::hash<std::string_view>()(name) % SHARDS];
+}
+
+USER_STATE user_cache::check(std::string_view name, std::string_view password) {
+    shard&     s = shard_of(name);
+    USER_STATE state = USER_UNKNOWN;
+
+    s.lock.lock();
+    lru_index::iterator it = s.index.find(name);
+    if (it != s.index.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        const entry& e = *it->second;
+        state = !e.exists ? USER_ABSENT : (e.password == password ? USER_MATCH : USER_MISMATCH);
+        ++s.hits;
+    }
+    else {
+        ++s.misses;
+    }
+    s.lock.unlock();
+    return state;
+}
+
+void user_cache::put(std::string_view name, std::string_view password) {
+    insert(name, password, true);
+}
+
+void user_cache::put_absent(std::string_view name) { insert(name, std::string_view(), false); }
+
+void user_cache::insert(std::string_view name, std::string_view password, bool exists) {
+    shard& s = shard_of(name);
+
+    s.lock.lock();
+    lru_index::iterator it = s.index.find(name);
+    if (it != s.index.end()) {
+        // 较早发出的查询不覆盖刚注册的用户
+        if (!exists && it->second->exists) {
+            s.lock.unlock();
+            return;
+        }
+        it->second->password.assign(password.data(), password.size());
+        it->second->exists = exists;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+    }
+    else {
+        s.lru.push_front(entry());
+        entry& e = s.lru.front();
+        e.name.assign(name.data(), name.size());
+        e.password.assign(password.data(), password.size());
+        e.exists = exists;
+        s.index[e.name] = s.lru.begin();
+
+        // 超出分片上限时从表尾淘汰, 先删索引再删节点, 索引的键指向节点中的用户名
+        while ((int)s.index.size() > CAPACITY / SHARDS) {
+            s.index.erase(s.lru.back().name);
+            s.lru.pop_back();
+            ++s.evictions;
+        }
+    }
+    ++s.loads;
+    s.lock.unlock();
+}
+
+user_cache_stats user_cache::stats() {
+    user_cache_stats st = {0, 0, 0, 0, 0};
+    for (int i = 0; i < SHARDS; ++i) {
+        shard& s = m_shards[i];
+        s.lock.lock();
+        st.hits += s.hits;
+        st.misses += s.misses;
+        st.loads += s.loads;
+        st.evictions += s.evictions;
+        st.entries += (int)s.index.size();
+        s.lock.unlock();
+    }
+    return st;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file user_cache.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 按需加载的用户缓存
+ * 懒加载模式下启动时不读取整张 user 表, 登录时未命中的用户由数据库线程按用户名查询后放入缓存;
+ * 数据库中不存在的用户也缓存, 避免重复查询; 缓存按用户名哈希分片, 每个分片按 LRU 淘汰
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../lock/locker.h"
+
+// 在内存中查找用户的结果
+enum USER_STATE {
+    USER_MATCH = 0, // 用户存在, 密码正确
+    USER_MISMATCH,  // 用户存在, 密码错误
+    USER_ABSENT,    // 用户不存在
+    USER_UNKNOWN    // 缓存未命中, 需要查询数据库
+};
+
+// 用户缓存统计信息
+struct user_cache_stats {
+    long hits;      // 命中次数, 包括命中不存在的用户
+    long misses;    // 未命中次数
+    long loads;     // 从数据库加载的条目数
+    long evictions; // LRU 淘汰次数
+    int  entries;   // 条目数
+};
+
+class user_cache {
+public:
+    static const int SHARDS = 16;          // 分片数
+    static const int CAPACITY = 1 << 20;   // 条目数上限, 平均分给各分片
+
+    // 单例模式
+    static user_cache* get_instance();
+
+    // 查找用户并校验密码
+    USER_STATE check(std::string_view name, std::string_view password);
+
+    // 放入从数据库查到或新注册的用户
+    void put(std::string_view name, std::string_view password);
+
+    // 记录数据库中不存在的用户
+    void put_absent(std::string_view name);
+
+    user_cache_stats stats();
+
+private:
+    struct entry {
+        std::string name;
+        std::string password;
+        bool        exists; // 数据库中是否存在
+    };
+
+    typedef std::list<entry> lru_list;
+    // 键指向链表节点中的用户名, 节点地址不变, 查找时不必构造 std::string
+    typedef std::unordered_map<std::string_view, lru_list::iterator> lru_index;
+
+    // 统计信息按分片记录, 在分片锁内更新, 各分片之间不共享锁; 按缓存行对齐避免伪共享
+    struct alignas(64) shard {
+        locker    lock;
+        lru_list  lru; // 表头为最近使用
+        lru_index index;
+        long      hits;
+        long      misses;
+        long      loads;
+        long      evictions;
+    };
+
+    user_cache();
+    ~user_cache();
+
+    shard& shard_of(std::string_view name);
+
+    // 放入条目并淘汰超出上限的条目
+    void insert(std::string_view name, std::string_view password, bool exists);
+
+private:
+    shard m_shards[SHARDS];
+};
+
+#endif
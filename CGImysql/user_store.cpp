@@ -0,0 +1,188 @@
+/**
+ * @file user_store.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 用户名和密码的内存索引
+ * @version 0.1
+ * @date 2023-03-30
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "user_store.h"
+
+#include <string.h>
+
+user_store::shard::shard() : count(0), arena(NULL), arena_used(0), bytes(0) {
+    memset(chunks, 0, sizeof(chunks));
+    table.store(new_table(INITIAL_SLOTS), std::memory_order_relaxed);
+    bytes = INITIAL_SLOTS * sizeof(uint32_t);
+}
+
+user_store::user_store() {}
+
+user_store::~user_store() {
+    for (int i = 0; i < SHARDS; ++i) {
+        shard& s = m_shards[i];
+        delete_table(s.table.load(std::memory_order_relaxed));
+        for (size_t j = 0; j < s.retired.size(); ++j) {
+            delete_table(s.retired[j]);
+        }
+        for (int j = 0; j < MAX_CHUNKS && s.chunks[j]; ++j) {
+            delete[] s.chunks[j];
+        }
+        for (size_t j = 0; j < s.blocks.size(); ++j) {
+            delete[] s.blocks[j];
+        }
+    }
+}
+
+user_store* user_store::get_instance() {
+    static user_store instance;
+    return &instance;
+}
+
+uint64_t user_store::hash(std::string_view name) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < name.size(); ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+user_store::slot_table* user_store::new_table(uint32_t size) {
+    slot_table* t = new slot_table;
+    t->mask = size - 1;
+    t->slots = new std::atomic<uint32_t>[size];
+    for (uint32_t i = 0; i < size; ++i) {
+        t->slots[i].store(0, std::memory_order_relaxed);
+    }
+    return t;
+}
+
+void user_store::delete_table(slot_table* t) {
+    delete[] t->slots;
+    delete t;
+}
+
+const user_store::entry* user_store::find(const shard& s, std::string_view name, uint64_t h) const {
+    // 取得槽位数组后, 其中发布的条目都已写完整
+    const slot_table* t = s.table.load(std::memory_order_acquire);
+    uint32_t          h32 = (uint32_t)(h >> 32);
+    for (uint32_t i = h32 & t->mask;; i = (i + 1) & t->mask) {
+        uint32_t index = t->slots[i].load(std::memory_order_acquire);
+        if (index == 0) {
+            return NULL;
+        }
+        --index;
+        const entry* e = &s.chunks[index / CHUNK_ENTRIES][index % CHUNK_ENTRIES];
+        if (e->hash == h32 && e->name_len == name.size() &&
+            memcmp(e->data, name.data(), name.size()) == 0) {
+            return e;
+        }
+    }
+}
+
+bool user_store::contains(std::string_view name) const {
+    uint64_t h = hash(name);
+    return find(m_shards[h & (SHARDS - 1)], name, h) != NULL;
+}
+
+bool user_store::check(std::string_view name, std::string_view password) const {
+    uint64_t     h = hash(name);
+    const entry* e = find(m_shards[h & (SHARDS - 1)], name, h);
+    return e && e->password_len == password.size() &&
+           memcmp(e->data + e->name_len, password.data(), password.size()) == 0;
+}
+
+const char* user_store::store(shard& s, std::string_view name, std::string_view password) {
+    int need = name.size() + password.size();
+    if (!s.arena || s.arena_used + need > ARENA_BLOCK) {
+        s.arena = new char[ARENA_BLOCK];
+        s.arena_used = 0;
+        s.blocks.push_back(s.arena);
+        s.bytes += ARENA_BLOCK;
+    }
+    char* p = s.arena + s.arena_used;
+    memcpy(p, name.data(), name.size());
+    memcpy(p + name.size(), password.data(), password.size());
+    s.arena_used += need;
+    return p;
+}
+
+void user_store::grow(shard& s) {
+    slot_table* old = s.table.load(std::memory_order_relaxed);
+    uint32_t    size = (old->mask + 1) * 2;
+    slot_table* t = new_table(size);
+    uint32_t    count = s.count.load(std::memory_order_relaxed);
+    for (uint32_t index = 0; index < count; ++index) {
+        const entry& e = s.chunks[index / CHUNK_ENTRIES][index % CHUNK_ENTRIES];
+        uint32_t     i = e.hash & t->mask;
+        while (t->slots[i].load(std::memory_order_relaxed) != 0) {
+            i = (i + 1) & t->mask;
+        }
+        t->slots[i].store(index + 1, std::memory_order_relaxed);
+    }
+
+    // 新数组填好后整体发布, 旧数组可能仍有线程在读, 不释放
+    s.table.store(t, std::memory_order_release);
+    s.retired.push_back(old);
+    s.bytes += size * sizeof(uint32_t);
+}
+
+bool user_store::insert(std::string_view name, std::string_view password) {
+    if (name.size() > MAX_NAME_LEN || password.size() > MAX_NAME_LEN) {
+        return false;
+    }
+    uint64_t h = hash(name);
+    shard&   s = m_shards[h & (SHARDS - 1)];
+
+    // 同一分片的插入串行, 查重和插入在同一临界区内完成
+    s.write_lock.lock();
+    uint32_t count = s.count.load(std::memory_order_relaxed);
+    if (find(s, name, h) || count >= (uint32_t)MAX_CHUNKS * CHUNK_ENTRIES) {
+        s.write_lock.unlock();
+        return false;
+    }
+
+    // 负载超过一半时扩容
+    if ((count + 1) * 2 > s.table.load(std::memory_order_relaxed)->mask + 1) {
+        grow(s);
+    }
+
+    // 先写好条目, 再发布到槽位
+    if (!s.chunks[count / CHUNK_ENTRIES]) {
+        s.chunks[count / CHUNK_ENTRIES] = new entry[CHUNK_ENTRIES];
+        s.bytes += CHUNK_ENTRIES * sizeof(entry);
+    }
+    entry& e = s.chunks[count / CHUNK_ENTRIES][count % CHUNK_ENTRIES];
+    e.hash = (uint32_t)(h >> 32);
+    e.name_len = name.size();
+    e.password_len = password.size();
+    e.data = store(s, name, password);
+
+    slot_table* t = s.table.load(std::memory_order_relaxed);
+    uint32_t    i = e.hash & t->mask;
+    while (t->slots[i].load(std::memory_order_relaxed) != 0) {
+        i = (i + 1) & t->mask;
+    }
+    s.count.store(count + 1, std::memory_order_relaxed);
+    t->slots[i].store(count + 1, std::memory_order_release);
+    s.write_lock.unlock();
+    return true;
+}
+
+user_store_stats user_store::stats() {
+    user_store_stats st;
+    st.users = 0;
+    st.bytes = 0;
+    for (int i = 0; i < SHARDS; ++i) {
+        shard& s = m_shards[i];
+        s.write_lock.lock();
+        st.users += s.count.load(std::memory_order_relaxed);
+        st.bytes += s.bytes;
+        s.write_lock.unlock();
+    }
+    return st;
+}
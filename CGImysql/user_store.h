@@ -0,0 +1,106 @@
+/**
+ * @file user_store.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 用户名和密码的内存索引
+ * 按用户名哈希分为 SHARDS 个分片, 每个分片是开放寻址的哈希表:
+ * 槽位只存条目下标, 条目 16 字节, 用户名和密码连续存放在只追加的内存块中;
+ * 查找不加锁, 插入时只锁所在分片; 条目和内存块一经写入不再移动,
+ * 扩容时新槽位数组整体发布, 旧数组保留到进程退出, 正在查找的线程仍可安全读取
+ * @version 0.1
+ * @date 2023-03-30
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string_view>
+#include <vector>
+
+#include "../lock/locker.h"
+
+// 用户索引统计信息
+struct user_store_stats {
+    long users; // 用户数
+    long bytes; // 槽位、条目和字符串占用的内存
+};
+
+class user_store {
+public:
+    static const int SHARDS = 64;                // 分片数, 为 2 的幂
+    static const int MAX_NAME_LEN = 255;         // 用户名和密码的最大长度
+    static const int CHUNK_ENTRIES = 4096;       // 每块条目数
+    static const int MAX_CHUNKS = 1024;          // 每个分片最多的条目块数
+    static const int ARENA_BLOCK = 64 * 1024;    // 字符串内存块大小
+    static const int INITIAL_SLOTS = 64;         // 每个分片初始槽位数, 为 2 的幂
+
+    // 单例模式
+    static user_store* get_instance();
+
+    // 用户是否存在, 不加锁
+    bool contains(std::string_view name) const;
+
+    // 校验用户名和密码, 不加锁
+    bool check(std::string_view name, std::string_view password) const;
+
+    // 加入用户, 用户已存在或长度超出限制时返回 false
+    bool insert(std::string_view name, std::string_view password);
+
+    user_store_stats stats();
+
+private:
+    // 条目, 用户名之后紧跟密码
+    struct entry {
+        uint32_t    hash;
+        uint8_t     name_len;
+        uint8_t     password_len;
+        const char* data;
+    };
+
+    // 槽位数组, 存放条目下标 + 1, 0 表示空槽
+    struct slot_table {
+        uint32_t               mask;
+        std::atomic<uint32_t>* slots;
+    };
+
+    struct shard {
+        shard();
+
+        std::atomic<slot_table*> table;          // 当前槽位数组
+        entry*                   chunks[MAX_CHUNKS]; // 条目块, 写入后不再移动
+        std::atomic<uint32_t>    count;          // 条目数
+        char*                    arena;          // 当前字符串内存块
+        int                      arena_used;     // 当前内存块已用字节数
+        long                     bytes;          // 占用的内存
+        std::vector<slot_table*> retired;        // 扩容后不再使用的槽位数组
+        std::vector<char*>       blocks;         // 全部字符串内存块
+        locker                   write_lock;     // 插入时加锁
+    };
+
+    user_store();
+    ~user_store();
+
+    static uint64_t hash(std::string_view name);
+
+    // 在分片中查找用户, 返回条目, 不存在时返回 NULL
+    const entry* find(const shard& s, std::string_view name, uint64_t h) const;
+
+    // 把字符串复制到分片的内存块中, 调用方持有写锁
+    const char* store(shard& s, std::string_view name, std::string_view password);
+
+    // 槽位数组扩容一倍, 调用方持有写锁
+    void grow(shard& s);
+
+    static slot_table* new_table(uint32_t size);
+
+    static void delete_table(slot_table* t);
+
+private:
+    shard m_shards[SHARDS];
+};
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file bench.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 基准测试公用的计时与线程函数
+ * bench 目录下每个文件是一个独立的 main, 由 make bench 编译并依次运行
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// 单调时钟的纳秒数
+static inline int64_t bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 启动 n 个线程, 第 i 个线程运行 fn(args + i * stride), 等待全部结束
+static inline void bench_run_threads(void* (*fn)(void*), void* args, size_t stride, int n) {
+    pthread_t* threads = new pthread_t[n];
+    for (int i = 0; i < n; ++i) {
+        pthread_create(&threads[i], NULL, fn, (char*)args + i * stride);
+    }
+    for (int i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    delete[] threads;
+}
+
+// 防止编译器把被测的计算优化掉
+template <typename T>
+static inline void bench_keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+#endif
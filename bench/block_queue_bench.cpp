@@ -0,0 +1,152 @@
+/**
+ * @file block_queue_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 异步日志阻塞队列的吞吐量
+ * 1、4 个生产者各放入 ITEMS 个 LINE_LEN 字节的 string, 1 个消费者取出, 队列长度 QUEUE_SIZE,
+ * 比较原 block_queue(复制元素, 每次 push 都广播)与现 block_queue 的 pop、pop_batch 每个元素的平均耗时
+ * 和消费者取元素的调用次数; 队列满时生产者让出 CPU 后重试
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <sched.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "../log/block_queue.h"
+#include "bench.h"
+#include "legacy_block_queue.h"
+
+static const int ITEMS = 1000000;   // 每个生产者放入的元素数
+static const int LINE_LEN = 80;     // 每个元素的字节数, 与一行日志相当
+static const int QUEUE_SIZE = 1024; // 与 main.c 中异步日志的队列长度相同
+static const int BATCH = 256;       // 与 Log::ASYNC_BATCH 相同
+static const int WAIT_MS = 10;      // 与 Log::ASYNC_WAIT_MS 相同
+
+static const int PRODUCERS[] = {1, 4};
+static const int NPRODUCERS = sizeof(PRODUCERS) / sizeof(PRODUCERS[0]);
+
+// 消费者取元素的方式
+enum bench_mode { LEGACY_POP, POP, POP_BATCH, POP_BATCH_WAIT, NMODES };
+
+static const char* MODE_NAME[NMODES] = {
+    "legacy pop", "pop", "pop_batch(256)", "pop_batch(256, 10)"};
+
+static const char LINE[LINE_LEN + 1] =
+    "2023-04-10 12:00:00.000000 [info]: deal with the client(127.0.0.1) fd 42 ok";
+
+struct bench_args {
+    int                         mode;
+    long                        total; // 消费者取出的元素总数
+    long                        calls; // 消费者取元素的调用次数
+    legacy_block_queue<string>* legacy;
+    block_queue<string>*        queue;
+};
+
+// 原实现的写日志线程每条日志构造一个 string 复制进队列
+static void* produce(void* arg) {
+    bench_args* a = (bench_args*)arg;
+    if (a->mode == LEGACY_POP) {
+        for (int i = 0; i < ITEMS; ++i) {
+            string line(LINE, LINE_LEN);
+            while (!a->legacy->push(line)) {
+                sched_yield();
+            }
+        }
+    }
+    else {
+        // 移入后 line 得到队列中空出位置的旧元素, 缓冲区循环使用
+        string line;
+        for (int i = 0; i < ITEMS; ++i) {
+            line.assign(LINE, LINE_LEN);
+            while (!a->queue->push(std::move(line))) {
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+static void* consume(void* arg) {
+    bench_args* a = (bench_args*)arg;
+    string*     items = new string[BATCH];
+    long        count = 0;
+    a->calls = 0;
+    while (count < a->total) {
+        int n = 0;
+        switch (a->mode) {
+            case LEGACY_POP:
+                n = a->legacy->pop(items[0]) ? 1 : 0;
+                break;
+            case POP:
+                n = a->queue->pop(items[0]) ? 1 : 0;
+                break;
+            case POP_BATCH:
+                n = a->queue->pop_batch(items, BATCH);
+                break;
+            case POP_BATCH_WAIT:
+                n = a->queue->pop_batch(items, BATCH, WAIT_MS);
+                break;
+        }
+        for (int i = 0; i < n; ++i) {
+            bench_keep(items[i].size());
+        }
+        count += n;
+        ++a->calls;
+    }
+    delete[] items;
+    return NULL;
+}
+
+// producers 个生产者放入、1 个消费者取出, 返回每个元素的平均纳秒数
+static double run(int mode, int producers, long& calls) {
+    bench_args a;
+    a.mode = mode;
+    a.total = (long)producers * ITEMS;
+    a.legacy = new legacy_block_queue<string>(QUEUE_SIZE);
+    a.queue = new block_queue<string>(QUEUE_SIZE);
+
+    bench_args* args = new bench_args[producers];
+    for (int i = 0; i < producers; ++i) {
+        args[i] = a;
+    }
+
+    int64_t   start = bench_now_ns();
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, consume, &a);
+    bench_run_threads(produce, args, sizeof(bench_args), producers);
+    pthread_join(consumer, NULL);
+    int64_t ns = bench_now_ns() - start;
+
+    calls = a.calls;
+    delete[] args;
+    delete a.legacy;
+    delete a.queue;
+    return (double)ns / a.total;
+}
+
+int main() {
+    printf(
+        "block queue: %d items of %d bytes per producer, queue size %d, 1 consumer\n", ITEMS,
+        LINE_LEN, QUEUE_SIZE);
+    printf("%20s", "consumer");
+    for (int p = 0; p < NPRODUCERS; ++p) {
+        printf(" %8d prod %10s", PRODUCERS[p], "calls");
+    }
+    printf("\n");
+
+    for (int mode = 0; mode < NMODES; ++mode) {
+        printf("%20s", MODE_NAME[mode]);
+        for (int p = 0; p < NPRODUCERS; ++p) {
+            long   calls = 0;
+            double ns = run(mode, PRODUCERS[p], calls);
+            printf(" %13.1f %10ld", ns, calls);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return 0;
+}
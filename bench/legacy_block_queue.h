@@ -0,0 +1,85 @@
+/**
+ * @file legacy_block_queue.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 原 block_queue 的副本, 只保留基准测试用到的操作, 作为对照
+ * 每次 push 都 broadcast 唤醒所有等待的线程, pop 把元素复制出来
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LEGACY_BLOCK_QUEUE_H
+#define LEGACY_BLOCK_QUEUE_H
+
+#include <stdlib.h>
+
+#include "../lock/locker.h"
+
+template <class T>
+class legacy_block_queue {
+public:
+    legacy_block_queue(int max_size = 1000) {
+        if (max_size <= 0) {
+            exit(-1);
+        }
+        m_max_size = max_size;
+        m_array = new T[max_size];
+        m_size = 0;
+        m_front = -1;
+        m_back = -1;
+    }
+
+    ~legacy_block_queue() { delete[] m_array; }
+
+    bool full() {
+        m_mutex.lock();
+        bool full = m_size >= m_max_size;
+        m_mutex.unlock();
+        return full;
+    }
+
+    // 往队列添加元素, 队列满时也唤醒所有等待的线程
+    bool push(const T& item) {
+        m_mutex.lock();
+        if (m_size >= m_max_size) {
+            m_cond.broadcast();
+            m_mutex.unlock();
+            return false;
+        }
+        m_back = (m_back + 1) % m_max_size;
+        m_array[m_back] = item;
+        m_size++;
+        m_cond.broadcast();
+        m_mutex.unlock();
+        return true;
+    }
+
+    // 取队头元素, 队列为空时等待
+    bool pop(T& item) {
+        m_mutex.lock();
+        while (m_size <= 0) {
+            if (!m_cond.wait(m_mutex.get())) {
+                m_mutex.unlock();
+                return false;
+            }
+        }
+        m_front = (m_front + 1) % m_max_size;
+        item = m_array[m_front];
+        m_size--;
+        m_mutex.unlock();
+        return true;
+    }
+
+private:
+    locker m_mutex;
+    cond   m_cond;
+
+    T*  m_array;
+    int m_size;
+    int m_max_size;
+    int m_front;
+    int m_back;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * @file legacy_log.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 原日志类写日志路径的副本, 作为对照
+ * 每条日志调用一次 localtime, 在 m_mutex 内格式化到共享的 m_buf 再构造 string;
+ * 异步模式经 legacy_block_queue 交给写线程, 队列满时在调用线程中写文件; 写文件不 fflush
+ * 只保留写日志的路径, 不按日期和行数切分文件
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LEGACY_LOG_H
+#define LEGACY_LOG_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <string>
+
+#include "../lock/locker.h"
+#include "legacy_block_queue.h"
+
+class legacy_log {
+public:
+    legacy_log() : m_count(0), m_fp(NULL), m_buf(NULL), m_log_queue(NULL), m_is_async(false) {}
+
+    // max_queue_size 不为 0 时为异步模式
+    bool init(const char* file_name, int log_buf_size, int split_lines, int max_queue_size) {
+        if (max_queue_size >= 1) {
+            m_is_async = true;
+            m_log_queue = new legacy_block_queue<std::string>(max_queue_size);
+            pthread_t tid;
+            pthread_create(&tid, NULL, flush_log_thread, this);
+        }
+        m_log_buf_size = log_buf_size;
+        m_buf = new char[m_log_buf_size];
+        memset(m_buf, '\0', m_log_buf_size);
+        m_split_lines = split_lines;
+        m_fp = fopen(file_name, "a");
+        return m_fp != NULL;
+    }
+
+    void write_log(int level, const char* format, ...) {
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+        time_t     t = now.tv_sec;
+        struct tm* sys_tm = localtime(&t);
+        struct tm  my_tm = *sys_tm;
+
+        char s[16] = {0};
+        switch (level) {
+            case 0:
+                strcpy(s, "[debug]:");
+                break;
+            case 2:
+                strcpy(s, "[warn]:");
+                break;
+            case 3:
+                strcpy(s, "[erro]:");
+                break;
+            default:
+                strcpy(s, "[info]:");
+                break;
+        }
+
+        // 原实现在这里按日期和行数切分文件
+        m_mutex.lock();
+        m_count++;
+        m_mutex.unlock();
+
+        va_list valst;
+        va_start(valst, format);
+
+        std::string log_str;
+        m_mutex.lock();
+        int n = snprintf(
+            m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ", my_tm.tm_year + 1900,
+            my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec,
+            now.tv_usec, s);
+        int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
+        m_buf[n + m] = '\n';
+        m_buf[n + m + 1] = '\0';
+        log_str = m_buf;
+        m_mutex.unlock();
+
+        if (m_is_async && !m_log_queue->full()) {
+            m_log_queue->push(log_str);
+        }
+        else {
+            m_mutex.lock();
+            fputs(log_str.c_str(), m_fp);
+            m_mutex.unlock();
+        }
+        va_end(valst);
+    }
+
+    void flush() {
+        m_mutex.lock();
+        fflush(m_fp);
+        m_mutex.unlock();
+    }
+
+private:
+    static void* flush_log_thread(void* arg) {
+        legacy_log* log = (legacy_log*)arg;
+        std::string single_log;
+        while (log->m_log_queue->pop(single_log)) {
+            log->m_mutex.lock();
+            fputs(single_log.c_str(), log->m_fp);
+            log->m_mutex.unlock();
+        }
+        return NULL;
+    }
+
+    int                              m_split_lines;
+    int                              m_log_buf_size;
+    long long                        m_count;
+    FILE*                            m_fp;
+    char*                            m_buf;
+    legacy_block_queue<std::string>* m_log_queue;
+    bool                             m_is_async;
+    locker                           m_mutex;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * @file log_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 各日志模式下写一条日志的耗时
+ * 1、4、8 个线程各写 ROUNDS 轮、每轮 LINES 条日志, 轮间休眠 SLEEP_US 微秒, 统计每次调用的平均耗时
+ * Log 是单例, 初始化后模式不能更改, 每种模式在单独的子进程中测试, 日志写到临时目录, 结束后删除
+ * 原实现的同步和异步模式使用 legacy_log, 参数与原 main.c 相同(异步队列长度 8)
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "bench.h"
+#include "legacy_log.h"
+
+static const int ROUNDS = 50;     // 每个线程写的轮数
+static const int LINES = 1000;    // 每轮写的日志条数
+static const int SLEEP_US = 5000; // 轮间休眠的微秒数
+
+static const int THREADS[] = {1, 4, 8};
+static const int NTHREADS = sizeof(THREADS) / sizeof(THREADS[0]);
+
+// 日志模式
+enum bench_mode { LEGACY_SYNC, LEGACY_ASYNC, SYNC, ASYNC, RING, BINARY, NMODES };
+
+static const char* MODE_NAME[NMODES] = {
+    "legacy sync", "legacy async", "sync", "async", "ring", "binary"};
+
+static legacy_log* g_legacy = NULL;
+
+// 每个线程的参数和结果
+struct bench_args {
+    int     id;
+    int64_t ns; // 写日志的总耗时, 不含休眠
+};
+
+static void* write_thread(void* arg) {
+    bench_args* a = (bench_args*)arg;
+    a->ns = 0;
+    for (int r = 0; r < ROUNDS; ++r) {
+        int64_t start = bench_now_ns();
+        for (int i = 0; i < LINES; ++i) {
+            if (g_legacy) {
+                g_legacy->write_log(1, "deal with the client(%s) fd %d line %d", "127.0.0.1", a->id, i);
+            }
+            else {
+                LOG_INFO("deal with the client(%s) fd %d line %d", "127.0.0.1", a->id, i);
+            }
+        }
+        a->ns += bench_now_ns() - start;
+        usleep(SLEEP_US);
+    }
+    return NULL;
+}
+
+// 在子进程中初始化日志并测试各线程数, 输出一行结果
+static void run_mode(int mode, const char* dir) {
+    char file[256];
+    snprintf(file, sizeof(file), "%s/ServerLog", dir);
+
+    bool ok = false;
+    switch (mode) {
+        case LEGACY_SYNC:
+        case LEGACY_ASYNC:
+            g_legacy = new legacy_log;
+            ok = g_legacy->init(file, 2000, 800000, mode == LEGACY_ASYNC ? 8 : 0);
+            break;
+        case SYNC:
+            ok = Log::get_instance()->init(file, 2000, 800000, 0);
+            break;
+        case ASYNC:
+            ok = Log::get_instance()->init(file, 2000, 800000, 1024);
+            break;
+        case RING:
+            ok = Log::get_instance()->init(file, 2000, 800000, 0, 1 << 18);
+            break;
+        case BINARY:
+            ok = Log::get_instance()->init(file, 2000, 800000, 0, 0, 64 << 20);
+            break;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: init failed\n", MODE_NAME[mode]);
+        exit(1);
+    }
+    if (!g_legacy) {
+        Log::get_instance()->set_level(LEVEL_INFO);
+    }
+
+    printf("%14s", MODE_NAME[mode]);
+    for (int t = 0; t < NTHREADS; ++t) {
+        int         n = THREADS[t];
+        bench_args* args = new bench_args[n];
+        for (int i = 0; i < n; ++i) {
+            args[i].id = i;
+        }
+        bench_run_threads(write_thread, args, sizeof(bench_args), n);
+
+        int64_t ns = 0;
+        for (int i = 0; i < n; ++i) {
+            ns += args[i].ns;
+        }
+        printf(" %12.1f", (double)ns / ((int64_t)n * ROUNDS * LINES));
+        fflush(stdout);
+        delete[] args;
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main() {
+    char dir[] = "/tmp/log_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf(
+        "logger: %d rounds x %d lines per thread, %d us sleep between rounds, ns per call\n",
+        ROUNDS, LINES, SLEEP_US);
+    printf("%14s", "mode");
+    for (int t = 0; t < NTHREADS; ++t) {
+        printf(" %9d thr", THREADS[t]);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    int status = 0;
+    for (int mode = 0; mode < NMODES && status == 0; ++mode) {
+        char sub[64];
+        snprintf(sub, sizeof(sub), "%s/%d", dir, mode);
+        mkdir(sub, 0755);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_mode(mode, sub);
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+    }
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir);
+    }
+    return status == 0 ? 0 : 1;
+}
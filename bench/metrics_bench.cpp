@@ -0,0 +1,108 @@
+/**
+ * @file metrics_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 运行指标的记录与抓取开销
+ * 测量 metrics::now_ns、metrics::record、metrics::add 每次调用的平均耗时(1、4、8 个线程, 按各线程的 CPU 时间),
+ * 以及已有这些线程的分片时 render 合并并输出一次的耗时
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+
+#include "../metrics/metrics.h"
+#include "bench.h"
+
+static const int CALLS = 10000000; // 每个线程每项调用的次数
+static const int RENDERS = 1000;   // 每轮 render 的次数
+
+static const int THREADS[] = {1, 4, 8};
+static const int NTHREADS = sizeof(THREADS) / sizeof(THREADS[0]);
+
+struct bench_args {
+    int64_t clock_ns;  // now_ns 的总耗时
+    int64_t record_ns; // record 的总耗时
+    int64_t add_ns;    // add 的总耗时
+};
+
+// 当前线程的 CPU 时间, 单核上多个线程轮流运行时不计入其他线程运行的时间
+static int64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* record_thread(void* arg) {
+    bench_args* a = (bench_args*)arg;
+
+    int64_t start = thread_cpu_ns();
+    int64_t sum = 0;
+    for (int i = 0; i < CALLS; ++i) {
+        sum += metrics::now_ns();
+    }
+    bench_keep(sum);
+    a->clock_ns = thread_cpu_ns() - start;
+
+    // 取值覆盖约 1 us 到 1 ms, 落在不同的桶中
+    start = thread_cpu_ns();
+    for (int i = 0; i < CALLS; ++i) {
+        metrics::record(metrics::TIME_TO_LAST_BYTE, 1000 + (int64_t)(i & 0xfffff));
+    }
+    a->record_ns = thread_cpu_ns() - start;
+
+    start = thread_cpu_ns();
+    for (int i = 0; i < CALLS; ++i) {
+        metrics::add(metrics::BYTES_SENT, i & 0xfff);
+    }
+    a->add_ns = thread_cpu_ns() - start;
+    return NULL;
+}
+
+int main() {
+    metrics* m = metrics::get_instance();
+    // 与 main 注册的瞬时值相同
+    m->add_gauge("webserver_active_connections", "Open client connections", [] { return 0L; });
+    m->add_gauge(
+        "webserver_queue_depth", "Requests waiting in the thread pool queue", [] { return 0L; });
+
+    printf("metrics: %d calls per thread, ns per call; render in us\n", CALLS);
+    printf(
+        "%8s %8s %12s %12s %12s %12s %10s\n", "threads", "shards", "now_ns", "record", "add",
+        "render", "bytes");
+
+    // 分片在线程退出后保留, 每轮 render 合并之前所有轮创建的分片
+    int shards = 0;
+    for (int t = 0; t < NTHREADS; ++t) {
+        int         n = THREADS[t];
+        bench_args* args = new bench_args[n];
+        bench_run_threads(record_thread, args, sizeof(bench_args), n);
+        shards += n;
+
+        int64_t clock_ns = 0, record_ns = 0, add_ns = 0;
+        for (int i = 0; i < n; ++i) {
+            clock_ns += args[i].clock_ns;
+            record_ns += args[i].record_ns;
+            add_ns += args[i].add_ns;
+        }
+        delete[] args;
+
+        size_t  bytes = 0;
+        int64_t start = bench_now_ns();
+        for (int i = 0; i < RENDERS; ++i) {
+            std::string out = m->render();
+            bytes = out.size();
+        }
+        int64_t render_ns = bench_now_ns() - start;
+
+        double calls = (double)n * CALLS;
+        printf(
+            "%8d %8d %12.1f %12.1f %12.1f %12.1f %10zu\n", n, shards, clock_ns / calls,
+            record_ns / calls, add_ns / calls, render_ns / 1000.0 / RENDERS, bytes);
+    }
+    return 0;
+}
@@ -0,0 +1,322 @@
+/**
+ * @file parser_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 请求报文解析的耗时
+ * 比较原实现(逐字节查找 \r\n 并改写为 \0, strpbrk/strspn/strcasecmp 逐个比较字段名)
+ * 与 http_scan.h 的向量扫描(按长度查表确定字段, 解析为 http_request 中的 string_view)
+ * 解析同一组请求时每个请求的平均耗时
+ * http_conn 依赖 MySQL 的头文件, 这里按 http_conn 中的实现重写了两种解析循环, 只保留扫描和取字段,
+ * 不包括路由和生成响应
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+#include "../http/http_request.h"
+#include "../http/http_scan.h"
+#include "bench.h"
+
+static const int ROUNDS = 200000; // 每个请求解析的次数
+
+// 浏览器访问首页、带 ETag 请求图片、提交登录表单, 以及 webbench 发出的请求
+static const char* const corpus[] = {
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.1.10:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/111.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+    "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n",
+
+    "GET /xxx.jpg HTTP/1.1\r\n"
+    "Host: 192.168.1.10:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/111.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://192.168.1.10:9006/picture.html\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "If-None-Match: \"5c1a2f-641e3b2a\"\r\n"
+    "\r\n",
+
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 192.168.1.10:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 28\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Origin: http://192.168.1.10:9006\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/111.0.0.0 Safari/537.36\r\n"
+    "Referer: http://192.168.1.10:9006/log.html\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n"
+    "user=name&password=passwd123",
+
+    "GET / HTTP/1.1\r\n"
+    "User-Agent: WebBench 1.5\r\n"
+    "Host: 192.168.1.10\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+};
+static const int CORPUS_SIZE = sizeof(corpus) / sizeof(corpus[0]);
+
+// 原实现: 找到行尾后把 \r\n 改为 \0, 再用以 \0 结尾的字符串函数解析
+struct legacy_parser {
+    char* buf;
+    int   read_idx;
+    int   checked_idx;
+    char* url;
+    char* version;
+    char* host;
+    long  content_length;
+    bool  linger;
+
+    bool parse_line() {
+        for (; checked_idx < read_idx; ++checked_idx) {
+            char temp = buf[checked_idx];
+            if (temp == '\r') {
+                if (checked_idx + 1 == read_idx || buf[checked_idx + 1] != '\n') {
+                    return false;
+                }
+                buf[checked_idx++] = '\0';
+                buf[checked_idx++] = '\0';
+                return true;
+            }
+            else if (temp == '\n') {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool parse_request_line(char* text) {
+        url = strpbrk(text, " \t");
+        if (!url) {
+            return false;
+        }
+        *url++ = '\0';
+        if (strcasecmp(text, "GET") != 0 && strcasecmp(text, "POST") != 0) {
+            return false;
+        }
+        url += strspn(url, " \t");
+        version = strpbrk(url, " \t");
+        if (!version) {
+            return false;
+        }
+        *version++ = '\0';
+        version += strspn(version, " \t");
+        return strcasecmp(version, "HTTP/1.1") == 0 && url[0] == '/';
+    }
+
+    // 返回 true 表示头部结束
+    bool parse_header(char* text) {
+        if (text[0] == '\0') {
+            return true;
+        }
+        else if (strncasecmp(text, "Connection:", 11) == 0) {
+            text += 11;
+            text += strspn(text, " \t");
+            linger = strcasecmp(text, "keep-alive") == 0;
+        }
+        else if (strncasecmp(text, "Content-length:", 15) == 0) {
+            text += 15;
+            text += strspn(text, " \t");
+            content_length = atol(text);
+        }
+        else if (strncasecmp(text, "Host:", 5) == 0) {
+            text += 5;
+            text += strspn(text, " \t");
+            host = text;
+        }
+        return false;
+    }
+
+    bool parse(char* data, int len) {
+        buf = data;
+        read_idx = len;
+        checked_idx = 0;
+        content_length = 0;
+        linger = false;
+        host = NULL;
+
+        int start = checked_idx;
+        if (!parse_line() || !parse_request_line(buf + start)) {
+            return false;
+        }
+        while (true) {
+            start = checked_idx;
+            if (!parse_line()) {
+                return false;
+            }
+            if (parse_header(buf + start)) {
+                return true;
+            }
+        }
+    }
+};
+
+// 现实现: 向量扫描行尾和分隔符, 不修改缓冲区, 字段名按长度查表
+struct scan_parser {
+    const char*  buf;
+    int          read_idx;
+    int          checked_idx;
+    http_request request;
+
+    // 返回行长度, 不含 \r\n; 没有完整的行返回 -1
+    int parse_line() {
+        const char* end = buf + read_idx;
+        const char* pos = scan_line_end(buf + checked_idx, end);
+        if (pos == end || *pos != '\r' || pos + 1 == end || pos[1] != '\n') {
+            return -1;
+        }
+        int len = pos - (buf + checked_idx);
+        checked_idx = pos - buf + 2;
+        return len;
+    }
+
+    bool parse_request_line(const char* text, int len) {
+        const char* end = text + len;
+        const char* method_end = scan_blank(text, end);
+        if (method_end == end) {
+            return false;
+        }
+        request.method = std::string_view(text, method_end - text);
+        if (!(request.method.size() == 3 && strncasecmp(text, "GET", 3) == 0) &&
+            !(request.method.size() == 4 && strncasecmp(text, "POST", 4) == 0)) {
+            return false;
+        }
+        const char* url = skip_blank(method_end + 1, end);
+        const char* url_end = scan_blank(url, end);
+        if (url_end == end) {
+            return false;
+        }
+        const char* version = skip_blank(url_end + 1, end);
+        request.version = std::string_view(version, end - version);
+        request.url = std::string_view(url, url_end - url);
+        return request.version.size() == 8 && strncasecmp(version, "HTTP/1.1", 8) == 0 &&
+               request.url[0] == '/';
+    }
+
+    // 返回 true 表示头部结束
+    bool parse_header(const char* text, int len) {
+        if (len == 0) {
+            return true;
+        }
+        const char* end = text + len;
+        const char* colon = scan_any(text, end, ':', ':');
+        if (colon == end) {
+            return false;
+        }
+        std::string_view name(text, colon - text);
+        const char*      value_begin = skip_blank(colon + 1, end);
+        std::string_view value(value_begin, end - value_begin);
+        request.add_header(name, value);
+        switch (lookup_header(name.data(), name.size())) {
+            case HEADER_CONNECTION:
+                request.keep_alive =
+                    value.size() == 10 && strncasecmp(value.data(), "keep-alive", 10) == 0;
+                break;
+            case HEADER_CONTENT_LENGTH: {
+                long length = 0;
+                for (size_t i = 0; i < value.size(); ++i) {
+                    length = length * 10 + (value[i] - '0');
+                }
+                request.content_length = length;
+                break;
+            }
+            case HEADER_HOST:
+                request.host = value;
+                break;
+            case HEADER_IF_NONE_MATCH:
+                request.if_none_match = value;
+                break;
+            default:
+                break;
+        }
+        return false;
+    }
+
+    bool parse(const char* data, int len) {
+        buf = data;
+        read_idx = len;
+        checked_idx = 0;
+        request.clear();
+
+        const char* text = buf + checked_idx;
+        int         line = parse_line();
+        if (line < 0 || !parse_request_line(text, line)) {
+            return false;
+        }
+        while (true) {
+            text = buf + checked_idx;
+            line = parse_line();
+            if (line < 0) {
+                return false;
+            }
+            if (parse_header(text, line)) {
+                return true;
+            }
+        }
+    }
+};
+
+int main() {
+#if defined(__AVX2__)
+    const char* width = "avx2";
+#elif defined(__SSE2__)
+    const char* width = "sse2";
+#else
+    const char* width = "scalar";
+#endif
+    printf("request parser: %d rounds, scanner %s, ns per request\n", ROUNDS, width);
+    printf("%8s %8s %12s %12s\n", "request", "bytes", "legacy", "scan");
+
+    // 原实现会改写缓冲区, 两种解析每次都先把请求复制到读缓冲区, 与从套接字读入相当
+    char          buf[2048];
+    legacy_parser legacy;
+    scan_parser*  scan = new scan_parser;
+    for (int r = 0; r < CORPUS_SIZE; ++r) {
+        int len = strlen(corpus[r]);
+
+        int64_t start = bench_now_ns();
+        for (int i = 0; i < ROUNDS; ++i) {
+            memcpy(buf, corpus[r], len);
+            if (!legacy.parse(buf, len)) {
+                fprintf(stderr, "legacy parser rejected request %d\n", r);
+                return 1;
+            }
+            bench_keep(legacy.host);
+        }
+        double legacy_ns = (double)(bench_now_ns() - start) / ROUNDS;
+
+        start = bench_now_ns();
+        for (int i = 0; i < ROUNDS; ++i) {
+            memcpy(buf, corpus[r], len);
+            if (!scan->parse(buf, len)) {
+                fprintf(stderr, "scan parser rejected request %d\n", r);
+                return 1;
+            }
+            bench_keep(scan->request.host);
+        }
+        double scan_ns = (double)(bench_now_ns() - start) / ROUNDS;
+
+        printf("%8d %8d %12.1f %12.1f\n", r, len, legacy_ns, scan_ns);
+    }
+    delete scan;
+    return 0;
+}
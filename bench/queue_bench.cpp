@@ -0,0 +1,133 @@
+/**
+ * @file queue_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 线程池请求队列策略的吞吐量
+ * n 个生产者与 n 个工作线程(n 为 1 到 64)通过同一个队列传递 ITEMS 个请求,
+ * 比较 list_work_queue(互斥锁 + 链表 + 信号量)、ring_work_queue 和 stealing_work_queue
+ * 每传递一个请求的平均耗时; 队列满时生产者让出 CPU 后重试, 与 threadpool::append 被拒绝的情形相当
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <sched.h>
+#include <stdio.h>
+
+#include <atomic>
+
+#include "../threadpool/work_queue.h"
+#include "bench.h"
+
+static const int ITEMS = 400000;      // 每轮传递的请求数
+static const int MAX_REQUESTS = 10000; // 与 main.c 中 QUEUE_MAX_REQUESTS 相同
+
+struct item {
+    int value;
+};
+
+static item items[ITEMS];
+static item stop_item; // 工作线程取到它时退出
+static bool lost;      // 有请求丢失或重复, main 以非 0 退出, make bench 随之失败
+
+template <typename Queue>
+struct worker_arg {
+    Queue*             queue;
+    int                id;
+    int                begin; // 生产者投递 items[begin, end)
+    int                end;
+    std::atomic<long>* consumed;
+    std::atomic<int>*  running; // 尚未退出的工作线程数
+};
+
+// 队列满时让出 CPU 后重试
+template <typename Queue>
+static void push_retry(Queue* queue, item* request) {
+    while (!queue->push(request)) {
+        sched_yield();
+    }
+}
+
+template <typename Queue>
+static void* produce(void* arg) {
+    worker_arg<Queue>* a = (worker_arg<Queue>*)arg;
+    for (int i = a->begin; i < a->end; ++i) {
+        push_retry(a->queue, &items[i]);
+    }
+    return NULL;
+}
+
+template <typename Queue>
+static void* consume(void* arg) {
+    worker_arg<Queue>* a = (worker_arg<Queue>*)arg;
+    long               count = 0;
+    while (true) {
+        item* request = a->queue->pop(a->id);
+        if (request == &stop_item) {
+            break;
+        }
+        if (request) {
+            bench_keep(request->value);
+            ++count;
+        }
+    }
+    a->consumed->fetch_add(count);
+    a->running->fetch_sub(1);
+    return NULL;
+}
+
+// n 个生产者和 n 个工作线程传递 ITEMS 个请求, 返回每个请求的平均纳秒数
+template <typename Queue>
+static double run(const char* name, int n) {
+    Queue              queue(n, MAX_REQUESTS);
+    std::atomic<long>  consumed(0);
+    std::atomic<int>   running(n);
+    worker_arg<Queue>* producers = new worker_arg<Queue>[n];
+    worker_arg<Queue>* consumers = new worker_arg<Queue>[n];
+    pthread_t*         threads = new pthread_t[n];
+    for (int i = 0; i < n; ++i) {
+        producers[i] = {&queue, i, (int)((long)ITEMS * i / n), (int)((long)ITEMS * (i + 1) / n),
+                        &consumed, &running};
+        consumers[i] = {&queue, i, 0, 0, &consumed, &running};
+    }
+
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < n; ++i) {
+        pthread_create(&threads[i], NULL, consume<Queue>, &consumers[i]);
+    }
+    bench_run_threads(produce<Queue>, producers, sizeof(worker_arg<Queue>), n);
+
+    // 每个工作线程取到一个结束标记后退出; 工作窃取队列把标记都投递到同一个线程,
+    // 它退出后其余标记要等空闲线程窃取, 所以一直投递到所有工作线程都退出
+    while (running.load() > 0) {
+        push_retry(&queue, &stop_item);
+        sched_yield();
+    }
+    for (int i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    int64_t elapsed = bench_now_ns() - start;
+
+    if (consumed.load() != ITEMS) {
+        fprintf(
+            stderr, "%s, %d threads: consumed %ld of %d requests\n", name, n, consumed.load(),
+            ITEMS);
+        lost = true;
+    }
+    delete[] producers;
+    delete[] consumers;
+    delete[] threads;
+    return (double)elapsed / ITEMS;
+}
+
+int main() {
+    printf("threadpool queue: %d requests, max_requests %d, ns per request\n", ITEMS, MAX_REQUESTS);
+    printf("%8s %12s %12s %12s\n", "threads", "list", "ring", "stealing");
+    for (int n = 1; n <= 64; n *= 2) {
+        double list = run<list_work_queue<item> >("list", n);
+        double ring = run<ring_work_queue<item> >("ring", n);
+        double stealing = run<stealing_work_queue<item> >("stealing", n);
+        printf("%8d %12.1f %12.1f %12.1f\n", n, list, ring, stealing);
+    }
+    return lost ? 1 : 0;
+}
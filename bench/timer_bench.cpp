@@ -0,0 +1,105 @@
+/**
+ * @file timer_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 定时器容器随连接数的开销
+ * 连接数从 1k 到 1M, 比较 sort_timer_lst 与 time_wheel 的添加、调整和删除:
+ * 先放入 n 个超时时间分布在 15 s 之后 1 s 内的定时器(即 3 * TIMESLOT),
+ * 再随机选取其中的定时器刷新超时时间(与收到数据时的 adjust_timer 相同)和删除, 再添加新定时器
+ * 每种操作测 n / 10 次, 最多 OPS 次; 升序链表的操作要遍历链表, 最多只测 OPS / (n / 1000) 次
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "../timer/lst_timer.h"
+#include "../timer/time_wheel.h"
+#include "bench.h"
+
+static const int    OPS = 100000;   // 每种操作最多的次数
+static const time_t TIMEOUT = 15000; // 3 * TIMESLOT 毫秒
+
+struct result {
+    double add;
+    double adjust;
+    double del;
+};
+
+static void noop(client_data*) {}
+
+static util_timer* make_timer(time_t expire) {
+    util_timer* timer = new util_timer;
+    timer->expire = expire;
+    timer->cb_func = noop;
+    timer->user_data = NULL;
+    return timer;
+}
+
+// 在已有 n 个定时器的容器上测量 ops 次调整、删除和添加, 返回每次操作的纳秒数
+// 链表按超时时间降序插入时每次都放在表头, 建立时不需要遍历
+template <typename Timers>
+static result run(int n, int ops) {
+    Timers                   timers;
+    std::vector<util_timer*> all(n);
+    time_t                   base = timer_now_ms() + TIMEOUT;
+    for (int i = n - 1; i >= 0; --i) {
+        all[i] = make_timer(base + (time_t)i * 1000 / n);
+        timers.add_timer(all[i]);
+    }
+
+    // 随机选取 ops 个不同的定时器
+    srand(n);
+    std::vector<int> picked(ops);
+    for (int i = 0; i < ops; ++i) {
+        picked[i] = i * (n / ops) + rand() % (n / ops);
+    }
+
+    result  r;
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < ops; ++i) {
+        util_timer* timer = all[picked[i]];
+        timer->expire = base + 1000 + i;
+        timers.adjust_timer(timer);
+    }
+    r.adjust = (double)(bench_now_ns() - start) / ops;
+
+    start = bench_now_ns();
+    for (int i = 0; i < ops; ++i) {
+        timers.del_timer(all[picked[i]]);
+    }
+    r.del = (double)(bench_now_ns() - start) / ops;
+
+    std::vector<util_timer*> added(ops);
+    for (int i = 0; i < ops; ++i) {
+        added[i] = make_timer(base + rand() % 1000);
+    }
+    start = bench_now_ns();
+    for (int i = 0; i < ops; ++i) {
+        timers.add_timer(added[i]);
+    }
+    r.add = (double)(bench_now_ns() - start) / ops;
+    return r;
+}
+
+int main() {
+    printf("timers: ns per operation, list ops scaled down as n grows\n");
+    printf(
+        "%8s %8s %12s %12s %12s %12s %12s %12s\n", "n", "list ops", "list add", "list adjust",
+        "list del", "wheel add", "wheel adjust", "wheel del");
+    for (int n = 1000; n <= 1000000; n *= 10) {
+        int    wheel_ops = n / 10 < OPS ? n / 10 : OPS;
+        int    list_ops = wheel_ops < OPS / (n / 1000) ? wheel_ops : OPS / (n / 1000);
+        result list = run<sort_timer_lst>(n, list_ops);
+        result wheel = run<time_wheel>(n, wheel_ops);
+        printf(
+            "%8d %8d %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f\n", n, list_ops, list.add,
+            list.adjust, list.del, wheel.add, wheel.adjust, wheel.del);
+    }
+    return 0;
+}
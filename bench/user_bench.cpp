@@ -0,0 +1,153 @@
+/**
+ * @file user_bench.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 用户索引在登录与注册混合访问下的耗时
+ * 先放入 USERS 个用户, 再由 1 到 16 个线程按 95% 登录校验、5% 注册新用户访问,
+ * 比较原实现(map<string, string>, 注册加全局锁)与 user_store 每次操作的平均耗时和占用的内存
+ * 原实现中登录读 map 不加锁, 与注册同时进行时会读到正在调整的红黑树, 这里读加读锁、写加写锁,
+ * 是原结构能正确运行的最低开销
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <malloc.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../CGImysql/user_store.h"
+#include "bench.h"
+
+static const int USERS = 1000000; // 预先放入的用户数
+static const int OPS = 500000;    // 每轮的总操作数, 平分给各线程
+static const int REGISTER = 20;   // 每 REGISTER 次操作中有一次注册
+
+// 原实现的用户表
+class legacy_users {
+public:
+    legacy_users() { pthread_rwlock_init(&m_lock, NULL); }
+
+    bool check(const std::string& name, const std::string& password) {
+        pthread_rwlock_rdlock(&m_lock);
+        std::map<std::string, std::string>::iterator it = m_users.find(name);
+        bool ok = it != m_users.end() && it->second == password;
+        pthread_rwlock_unlock(&m_lock);
+        return ok;
+    }
+
+    bool insert(const std::string& name, const std::string& password) {
+        pthread_rwlock_wrlock(&m_lock);
+        bool ok = m_users.insert(std::make_pair(name, password)).second;
+        pthread_rwlock_unlock(&m_lock);
+        return ok;
+    }
+
+private:
+    std::map<std::string, std::string> m_users;
+    pthread_rwlock_t                   m_lock;
+};
+
+static std::vector<std::string> names;
+static std::vector<std::string> passwords;
+
+struct worker_arg {
+    bool legacy;
+    int  id;
+    int  ops;
+    int  round;
+    long failed;
+};
+
+static legacy_users* legacy;
+static bool          failed; // 有操作失败, main 以非 0 退出, make bench 随之失败
+
+static void* worker(void* arg) {
+    worker_arg* a = (worker_arg*)arg;
+    user_store* store = user_store::get_instance();
+    char        name[32];
+    uint64_t    seed = a->id * 7919 + 1;
+    a->failed = 0;
+    for (int i = 0; i < a->ops; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        bool ok;
+        if (i % REGISTER == 0) {
+            // 注册的用户名在各轮、各线程之间不重复
+            int len = snprintf(name, sizeof(name), "new%d_%d_%d", a->round, a->id, i);
+            ok = a->legacy ? legacy->insert(std::string(name, len), "passwd")
+                           : store->insert(std::string_view(name, len), "passwd");
+        }
+        else {
+            int u = (seed >> 33) % USERS;
+            ok = a->legacy ? legacy->check(names[u], passwords[u])
+                           : store->check(names[u], passwords[u]);
+        }
+        a->failed += !ok;
+    }
+    return NULL;
+}
+
+// threads 个线程共执行 OPS 次操作, 返回每次操作的平均纳秒数
+static double run(bool use_legacy, int threads, int round) {
+    worker_arg* args = new worker_arg[threads];
+    for (int i = 0; i < threads; ++i) {
+        args[i] = {use_legacy, i, OPS / threads, round, 0};
+    }
+    int64_t start = bench_now_ns();
+    bench_run_threads(worker, args, sizeof(worker_arg), threads);
+    int64_t elapsed = bench_now_ns() - start;
+    for (int i = 0; i < threads; ++i) {
+        if (args[i].failed) {
+            fprintf(
+                stderr, "%s, %d threads: thread %d: %ld operations failed\n",
+                use_legacy ? "map" : "user_store", threads, i, args[i].failed);
+            failed = true;
+        }
+    }
+    delete[] args;
+    return (double)elapsed / (OPS / threads * threads);
+}
+
+int main() {
+    names.reserve(USERS);
+    passwords.reserve(USERS);
+    for (int i = 0; i < USERS; ++i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user%07d", i);
+        names.push_back(buf);
+        snprintf(buf, sizeof(buf), "pw%07d", i);
+        passwords.push_back(buf);
+    }
+
+    // 两种实现各自放入全部用户, 用堆内存的增量估计原实现占用的内存
+    size_t before = mallinfo2().uordblks;
+    legacy = new legacy_users;
+    for (int i = 0; i < USERS; ++i) {
+        legacy->insert(names[i], passwords[i]);
+    }
+    size_t legacy_bytes = mallinfo2().uordblks - before;
+
+    user_store* store = user_store::get_instance();
+    for (int i = 0; i < USERS; ++i) {
+        store->insert(names[i], passwords[i]);
+    }
+    user_store_stats st = store->stats();
+
+    printf(
+        "user index: %d users, 1 register per %d operations, ns per operation\n", USERS, REGISTER);
+    printf(
+        "memory: map %.1f MB, user_store %.1f MB\n", legacy_bytes / 1048576.0,
+        st.bytes / 1048576.0);
+    printf("%8s %12s %12s\n", "threads", "map", "user_store");
+    int round = 0;
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        double map_ns = run(true, threads, round);
+        double store_ns = run(false, threads, round);
+        printf("%8d %12.1f %12.1f\n", threads, map_ns, store_ns);
+        ++round;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file file_cache.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 静态文件缓存
+ * @version 0.1
+ * @date 2023-03-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "file_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+cached_file::~cached_file() {
+    delete[] data;
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+file_cache::file_cache() : m_misses(0), m_evictions(0), m_entries(0), m_bytes(0) {
+    for (int i = 0; i < SHARDS; ++i) {
+        m_shards[i].hits = 0;
+    }
+}
+
+file_cache::~file_cache() {}
+
+file_cache* file_cache::get_instance() {
+    static file_cache instance;
+    return &instance;
+}
+
+time_t file_cache::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+file_cache::shard& file_cache::shard_of(std::string_view path) {
+    return m_shards[std::hash<std::string_view>()(path) % SHARDS];
+}
+
+file_cache::RESULT file_cache::acquire(const char* path, std::shared_ptr<cached_file>& file) {
+    time_t cur = now_ms();
+    shard& s = shard_of(path);
+    file.reset();
+
+    // 命中且在校验间隔内, 直接返回; 只加读锁, 最近使用时间在同一毫秒内只写一次
+    s.lock.rdlock();
+    file_index::iterator it = s.index.find(path);
+    if (it != s.index.end()) {
+        file = it->second;
+    }
+    s.lock.unlock();
+
+    if (file && cur - file->checked.load(std::memory_order_relaxed) < REVALIDATE_MS) {
+        if (file->used.load(std::memory_order_relaxed) != cur) {
+            file->used.store(cur, std::memory_order_relaxed);
+        }
+        s.hits.fetch_add(1, std::memory_order_relaxed);
+        return FOUND;
+    }
+
+    // 通过stat获取请求资源文件信息, 失败表示资源不存在
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        s.lock.wrlock();
+        erase(s, path);
+        s.lock.unlock();
+        file.reset();
+        return NOT_FOUND;
+    }
+
+    // 缓存的条目未被修改, 更新校验时间
+    if (file && file->mtime == st.st_mtime && file->size == st.st_size && file->ino == st.st_ino) {
+        file->checked.store(cur, std::memory_order_relaxed);
+        file->used.store(cur, std::memory_order_relaxed);
+        s.hits.fetch_add(1, std::memory_order_relaxed);
+        return FOUND;
+    }
+
+    // 未命中或文件已修改, 重新加载
+    RESULT ret = load(path, st, file);
+    s.lock.wrlock();
+    erase(s, path);
+    if (ret == FOUND) {
+        file->checked = cur;
+        file->used = cur;
+        insert(s, file);
+    }
+    s.lock.unlock();
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+
+    if (ret == FOUND) {
+        evict();
+    }
+    return ret;
+}
+
+file_cache::RESULT file_cache::load(
+    const char* path, const struct stat& st, std::shared_ptr<cached_file>& file) {
+    file.reset();
+
+    // 判断文件的权限, 是否可读
+    if (!(st.st_mode & S_IROTH)) {
+        return FORBIDDEN;
+    }
+
+    // 判断文件类型, 目录不能作为静态文件发送
+    if (S_ISDIR(st.st_mode)) {
+        return IS_DIRECTORY;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return LOAD_ERROR;
+    }
+
+    std::shared_ptr<cached_file> entry(new cached_file);
+    entry->path = path;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->ino = st.st_ino;
+
+    // 小文件读入内存, 之后不再访问文件系统
+    if (st.st_size <= SMALL_FILE_SIZE) {
+        entry->data = new char[st.st_size > 0 ? st.st_size : 1];
+        off_t done = 0;
+        while (done < st.st_size) {
+            ssize_t n = pread(fd, entry->data + done, st.st_size - done, done);
+            if (n <= 0) {
+                close(fd);
+                return LOAD_ERROR;
+            }
+            done += n;
+        }
+        close(fd);
+    }
+    // 大文件保留描述符, 由连接各自以偏移量 sendfile
+    else {
+        entry->fd = fd;
+    }
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx\"", (long)st.st_mtime, (long)st.st_size);
+    entry->etag = buf;
+    snprintf(
+        buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Length:%ld\r\nETag:%s\r\n", (long)st.st_size,
+        entry->etag.c_str());
+    entry->headers = buf;
+
+    file = entry;
+    return FOUND;
+}
+
+void file_cache::insert(shard& s, const std::shared_ptr<cached_file>& file) {
+    s.index[file->path] = file;
+    ++m_entries;
+    if (file->data) {
+        m_bytes += file->size;
+    }
+}
+
+void file_cache::erase(shard& s, std::string_view path) {
+    file_index::iterator it = s.index.find(path);
+    if (it == s.index.end()) {
+        return;
+    }
+    if (it->second->data) {
+        m_bytes -= it->second->size;
+    }
+    --m_entries;
+    // 键指向条目中的路径, 先从表中删除再释放条目
+    std::shared_ptr<cached_file> entry = it->second;
+    s.index.erase(it);
+}
+
+void file_cache::evict() {
+    // 超出上限只在加载新文件后发生, 每淘汰一个条目遍历一次各分片, 命中时不承担这部分开销
+    // 正在发送的连接仍持有被淘汰的条目
+    while (m_entries > 1 && (m_bytes > MAX_CACHE_BYTES || m_entries > MAX_ENTRIES)) {
+        std::shared_ptr<cached_file> oldest;
+        int                          oldest_shard = 0;
+        for (int i = 0; i < SHARDS; ++i) {
+            m_shards[i].lock.rdlock();
+            for (file_index::iterator it = m_shards[i].index.begin();
+                 it != m_shards[i].index.end(); ++it) {
+                if (!oldest || it->second->used.load(std::memory_order_relaxed) <
+                                   oldest->used.load(std::memory_order_relaxed)) {
+                    oldest = it->second;
+                    oldest_shard = i;
+                }
+            }
+            m_shards[i].lock.unlock();
+        }
+        if (!oldest) {
+            return;
+        }
+
+        // 遍历之后条目可能已被其他线程替换或删除, 仍是同一条目时才删除
+        shard& s = m_shards[oldest_shard];
+        s.lock.wrlock();
+        file_index::iterator it = s.index.find(oldest->path);
+        if (it != s.index.end() && it->second == oldest) {
+            erase(s, oldest->path);
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        s.lock.unlock();
+    }
+}
+
+file_cache_stats file_cache::stats() {
+    file_cache_stats s;
+    s.hits = 0;
+    for (int i = 0; i < SHARDS; ++i) {
+        s.hits += m_shards[i].hits.load(std::memory_order_relaxed);
+    }
+    s.misses = m_misses.load(std::memory_order_relaxed);
+    s.evictions = m_evictions.load(std::memory_order_relaxed);
+    s.entries = m_entries.load(std::memory_order_relaxed);
+    s.bytes = m_bytes.load(std::memory_order_relaxed);
+    return s;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file file_cache.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 静态文件缓存
+ * 以文件路径为键, 缓存文件大小、修改时间、ETag 与预先生成的响应头部;
+ * 小文件把内容读入内存, 由一次 writev 连同头部发送, 命中时不访问文件系统;
+ * 大文件缓存打开的文件描述符, 各连接以自己的偏移量 sendfile
+ * 条目每隔 REVALIDATE_MS 用 stat 检查一次修改时间, 内存超出上限时按 LRU 淘汰
+ * 按路径哈希分片, 命中只加分片的读锁、不申请内存; 最近使用时间记在条目上, 淘汰时查找最久未用的条目
+ * @version 0.1
+ * @date 2023-03-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../lock/locker.h"
+
+// 缓存的文件, 由缓存和正在发送它的连接共同持有
+// 被淘汰或失效后, 最后一个持有者释放时才关闭文件、释放内容
+struct cached_file {
+    cached_file() : data(NULL), fd(-1), size(0), mtime(0), ino(0), checked(0), used(0) {}
+    ~cached_file();
+
+    std::string         path;
+    char*               data;    // 小文件的内容, 大文件为 NULL
+    int                 fd;      // 大文件的描述符, 小文件为 -1
+    off_t               size;    // 文件大小
+    time_t              mtime;   // 修改时间
+    ino_t               ino;     // inode, 文件被替换时变化
+    std::atomic<time_t> checked; // 上次校验的时间, 毫秒
+    std::atomic<time_t> used;    // 上次命中的时间, 毫秒, 同一毫秒内只写一次
+    std::string         etag;    // 由修改时间和大小生成的 ETag, 带引号
+    std::string         headers; // 预先生成的状态行、Content-Length 与 ETag
+};
+
+// 文件缓存统计信息
+struct file_cache_stats {
+    long hits;      // 命中次数
+    long misses;    // 未命中或失效后重新加载的次数
+    long evictions; // LRU 淘汰次数
+    int  entries;   // 条目数
+    long bytes;     // 缓存的文件内容字节数
+};
+
+class file_cache {
+public:
+    static const int  SMALL_FILE_SIZE = 64 * 1024;         // 不超过该大小的文件内容放入内存
+    static const long MAX_CACHE_BYTES = 64L * 1024 * 1024; // 缓存文件内容的内存上限
+    static const int  MAX_ENTRIES = 1024;                  // 条目数上限, 限制打开的描述符数
+    static const int  REVALIDATE_MS = 1000;                // 条目校验修改时间的间隔
+    static const int  SHARDS = 16;                         // 分片数
+
+    // 查找结果
+    enum RESULT { FOUND = 0, NOT_FOUND, FORBIDDEN, IS_DIRECTORY, LOAD_ERROR };
+
+    // 单例模式
+    static file_cache* get_instance();
+
+    // 取出路径对应的文件, 未命中或需要校验时才访问文件系统
+    RESULT acquire(const char* path, std::shared_ptr<cached_file>& file);
+
+    file_cache_stats stats();
+
+private:
+    file_cache();
+    ~file_cache();
+
+    // 键指向条目中的路径, 条目在表中时不会释放, 查找时不必构造 std::string
+    typedef std::unordered_map<std::string_view, std::shared_ptr<cached_file> > file_index;
+
+    // 命中次数按分片记录, 按缓存行对齐避免伪共享
+    struct alignas(64) shard {
+        rwlocker          lock;
+        file_index        index;
+        std::atomic<long> hits;
+    };
+
+    // 读取文件信息并加载内容或打开描述符, 不持有锁
+    RESULT load(const char* path, const struct stat& st, std::shared_ptr<cached_file>& file);
+
+    // 路径所在的分片
+    shard& shard_of(std::string_view path);
+
+    // 加入缓存, 调用方持有分片的写锁
+    void insert(shard& s, const std::shared_ptr<cached_file>& file);
+
+    // 从缓存中删除条目, 调用方持有分片的写锁
+    void erase(shard& s, std::string_view path);
+
+    // 超出内存或条目数上限时淘汰最久未用的条目, 不持有锁
+    void evict();
+
+    static time_t now_ms();
+
+private:
+    shard             m_shards[SHARDS];
+    std::atomic<long> m_misses;
+    std::atomic<long> m_evictions;
+    std::atomic<int>  m_entries;
+    std::atomic<long> m_bytes;
+};
+
+#endif
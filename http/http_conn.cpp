@@ -11,11 +11,17 @@
 #include "http_conn.h"
 
 #include <mysql/mysql.h>
+#include <sys/sendfile.h>
 
+#include <algorithm>
 #include <fstream>
 #include <map>
 
+#include "../CGImysql/user_cache.h"
+#include "../CGImysql/user_store.h"
 #include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "http_scan.h"
 
 // #define connfdET //边缘触发非阻塞
 #define connfdLT // 水平触发阻塞
@@ -23,6 +29,9 @@
 // #define listenfdET //边缘触发非阻塞
 #define listenfdLT // 水平触发阻塞
 
+// #define LAZY_USER_LOAD // 启动时不读取 user 表, 登录时按需查询并缓存
+#define PRELOAD_USERS 10000 // 懒加载模式下后台预加载的用户数, 为 0 时不预加载
+
 // 定义 http 响应的一些状态信息
 const char* ok_200_title = "OK";
 const char* error_400_title = "Bad Request";
@@ -34,15 +43,15 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the request file.\n";
+const char* error_503_title = "Service Unavailable";
+const char* error_503_form = "The server is overloaded, please try again later.\n";
+const char* not_modified_304_title = "Not Modified";
 
 // 当浏览器出现连接重置时
 // 可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
 //  const char *doc_root = "/home/qgy/github/TinyWebServer/root";
 const char* doc_root = "/mnt/e/_cc/GitHub/WebServerDemo/root";
 
-// 将表中的用户名和密码放入 map
-map<string, string> users;
-locker              m_lock;
 
 #pragma region[epoll 相关代码]
 
@@ -107,8 +116,39 @@ void modfd(int epollfd, int fd, int ev) {
 
 #pragma endregion[epoll 相关代码]
 
-void http_conn::initmysql_result(connection_pool* connPool) {
+#ifdef LAZY_USER_LOAD
+// 后台预加载线程, 不阻塞启动; 预加载期间未命中的用户照常按需查询
+static void* preload_users(void* arg) {
+    MYSQL*         mysql = NULL;
+    connectionRAII mysqlcon(&mysql, (connection_pool*)arg);
+
+    char sql[64];
+    snprintf(sql, sizeof(sql), "SELECT username,passwd FROM user LIMIT %d", PRELOAD_USERS);
+    if (mysql_query(mysql, sql)) {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        ((connection_pool*)arg)->ReportError(mysql, mysql_errno(mysql));
+        return NULL;
+    }
+    MYSQL_RES* result = mysql_store_result(mysql);
+    if (!result) {
+        return NULL;
+    }
+    while (MYSQL_ROW row = mysql_fetch_row(result)) {
+        user_cache::get_instance()->put(row[0], row[1]);
+    }
+    mysql_free_result(result);
+    return NULL;
+}
+#endif
 
+void http_conn::initmysql_result(connection_pool* connPool) {
+#ifdef LAZY_USER_LOAD
+    // 懒加载模式下立即开始服务, 只在后台预加载一部分用户
+    pthread_t tid;
+    if (PRELOAD_USERS > 0 && pthread_create(&tid, NULL, preload_users, connPool) == 0) {
+        pthread_detach(tid);
+    }
+#else
     // 先从连接池中取一个连接
     MYSQL*         mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
@@ -116,6 +156,7 @@ void http_conn::initmysql_result(connection_pool* connPool) {
     // 在user表中检索username，passwd数据，浏览器端输入
     if (mysql_query(mysql, "SELECT username,passwd FROM user")) {
         LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        connPool->ReportError(mysql, mysql_errno(mysql));
     }
 
     // 从表中检索完整的结果集
@@ -127,113 +168,173 @@ void http_conn::initmysql_result(connection_pool* connPool) {
     // 返回所有字段结构的数组
     MYSQL_FIELD* fields = mysql_fetch_fields(result);
 
-    // 从结果集中获取下一行，将对应的用户名和密码，存入map中
+    // 从结果集中获取下一行，将对应的用户名和密码，存入用户索引中
     while (MYSQL_ROW row = mysql_fetch_row(result)) {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+        user_store::get_instance()->insert(row[0], row[1]);
     }
+#endif
 }
 
 // 静态类成员, 无论这个类的对象有多少个, 静态成员都只有一个
 // 静态类成员属于类, 不属于对象
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
+db_worker<http_conn>* http_conn::m_db_worker = NULL;
 
 void http_conn::close_conn(bool real_close) {
     if (real_close && (m_sockfd != -1)) {
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        release_responses();
+        free_buffers();
     }
 }
 
-void http_conn::init(int sockfd, const sockaddr_in& addr) {
+void http_conn::init(int sockfd, const sockaddr_in& addr, int epollfd) {
+    m_epollfd = epollfd;
     m_sockfd = sockfd;
     m_address = addr;
     // int reuse=1;
     // setsockopt(m_sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
     addfd(m_epollfd, sockfd, true);
     m_user_count++;
+    m_accept_ns = metrics::now_ns();
     init();
 }
 
 void http_conn::init() {
-    mysql = NULL;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
-    m_check_state = CHECK_STATE_REQUESTLINE; // check_state默认为分析请求行状态
-    m_linger = false;
-    m_method = GET;
-    m_url = 0;
-    m_version = 0;
-    m_content_length = 0;
-    m_host = 0;
+    m_db_handler = NULL;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
-    m_write_idx = 0;
-    cgi = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    m_pipelined = false;
+    m_request_ns = 0;
+    init_request();
+
+    // 连接在发送途中被关闭时, 响应引用的文件在这里释放
+    release_responses();
+
+    // 上一个请求已处理完, 缓冲区归还对象池, 下次有数据可读时再分配
+    free_buffers();
+}
+
+void http_conn::init_request() {
+    m_check_state = CHECK_STATE_REQUESTLINE; // check_state默认为分析请求行状态
+    m_method = GET;
+    m_request.clear();
     memset(m_real_file, '\0', FILENAME_LEN);
+    close_file();
+
+    // 下一个请求从当前请求结束处开始
+    m_start_line = m_checked_idx;
 }
 
-http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
+void http_conn::alloc_buffers() {
+    if (!m_read_buf) {
+        m_read_chain.reserve();
+        m_read_buf = m_read_chain.data();
+        m_read_size = m_read_chain.capacity();
+    }
+    if (!m_write_buf) {
+        m_write_buf = (char*)object_pool<write_block>::get_instance()->allocate();
+        memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    }
+}
 
+void http_conn::free_buffers() {
+    if (m_read_buf) {
+        m_read_chain.clear();
+        m_read_buf = NULL;
+        m_read_size = 0;
+    }
+    if (m_write_buf) {
+        object_pool<write_block>::get_instance()->deallocate(m_write_buf);
+        m_write_buf = NULL;
+    }
+}
+
+http_conn::LINE_STATUS http_conn::parse_line() {
     // m_read_idx 指向缓冲区 m_read_buf 的数据末尾的下一个字节
     // m_checked_idx 指向从状态机当前正在分析的字节
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) {
+    // 按向量宽度查找第一个 \r 或 \n, 不修改缓冲区, 行的长度由调用方根据下标计算
+    const char* end = m_read_buf + m_read_idx;
+    const char* pos = scan_line_end(m_read_buf + m_checked_idx, end);
+    m_checked_idx = pos - m_read_buf;
 
-        // temp 为将要分析的字节
-        temp = m_read_buf[m_checked_idx];
-
-        // 如果当前是 \r 字符，则有可能会读取到完整行
-        if (temp == '\r') {
-
-            // 下一个字符达到了buffer结尾，则接收不完整，需要继续接收
-            if ((m_checked_idx + 1) == m_read_idx) {
-                return LINE_OPEN;
-            }
+    // 并没有找到 \r\n，需要继续接收
+    if (pos == end) {
+        return LINE_OPEN;
+    }
 
-            // 下一个字符是\n，将\r\n改为\0\0
-            else if (m_read_buf[m_checked_idx + 1] == '\n') {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
+    // 如果当前是 \r 字符，则有可能会读取到完整行
+    if (*pos == '\r') {
 
-            // 如果都不符合，则返回语法错误
-            return LINE_BAD;
+        // 下一个字符达到了buffer结尾，则接收不完整，需要继续接收
+        if ((m_checked_idx + 1) == m_read_idx) {
+            return LINE_OPEN;
         }
 
-        // 如果当前字符是 \n，也有可能读取到完整行
-        // 一般是上次读取到 \r 就到buffer末尾了，没有接收完整，再次接收时会出现这种情况
-        else if (temp == '\n') {
-            // 前一个字符是 \r，则接收完整
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r') {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+        // 下一个字符是\n，跳过\r\n
+        else if (m_read_buf[m_checked_idx + 1] == '\n') {
+            m_checked_idx += 2;
+            return LINE_OK;
         }
+
+        // 如果都不符合，则返回语法错误
+        return LINE_BAD;
     }
 
-    // 并没有找到 \r\n，需要继续接收
-    return LINE_OPEN;
+    // 如果当前字符是 \n，也有可能读取到完整行
+    // 前一个字符是 \r，则接收完整
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r') {
+        m_checked_idx++;
+        return LINE_OK;
+    }
+    return LINE_BAD;
+}
+
+bool http_conn::grow_read_buf() {
+    int pending = m_read_idx - m_start_line;
+    int need = pending + 1;
+
+    // 请求体整体放在同一段中, 解析时才能作为一个字符串使用
+    if (m_check_state == CHECK_STATE_CONTENT) {
+        need = m_request.content_length + 1;
+    }
+    // 请求行和头部行只使用池化段
+    else if (need > chain_buffer::max_segment_capacity()) {
+        LOG_ERROR("%s", "request line too long");
+        return false;
+    }
+
+    if (!m_read_chain.extend(m_start_line, m_read_idx, need)) {
+        return false;
+    }
+    m_read_buf = m_read_chain.data();
+    m_read_size = m_read_chain.capacity();
+    m_checked_idx -= m_start_line;
+    m_read_idx = pending;
+    m_start_line = 0;
+    return true;
 }
 
 bool http_conn::read_once() {
-    if (m_read_idx >= READ_BUFFER_SIZE) {
+    alloc_buffers();
+
+    // 空闲连接开始读取新的请求
+    if (m_request_ns == 0) {
+        m_request_ns = metrics::now_ns();
+    }
+
+    // 留出 1 字节, 使缓冲区中的数据之后总有一个 \0
+    if (m_read_idx >= m_read_size - 1 && !grow_read_buf()) {
         return false;
     }
     int bytes_read = 0;
 
 #ifdef connfdLT
 
-    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
     m_read_idx += bytes_read;
 
     if (bytes_read <= 0) {
@@ -246,8 +347,13 @@ bool http_conn::read_once() {
 
 #ifdef connfdET
     while (true) {
+        // 当前段写满后换到新段继续接收
+        if (m_read_idx >= m_read_size - 1 && !grow_read_buf()) {
+            return false;
+        }
+
         // 从套接字接收数据, 存储在 m_read_buf 缓冲区
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
         if (bytes_read == -1) {
             // 非阻塞 ET 模式下，需要一次性将数据读完
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -265,90 +371,88 @@ bool http_conn::read_once() {
 #endif
 }
 
-http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
+http_conn::HTTP_CODE http_conn::parse_request_line(char* text, int len) {
+    const char* end = text + len;
 
     // 在HTTP报文中
     // 请求行用来说明请求类型
     // 要访问的资源
     // 以及所使用的HTTP版本，其中各个部分之间通过 \t 或空格分隔
-    // 请求行中最先含有空格和 \t 任一字符的位置并返回
-    m_url = strpbrk(text, " \t");
+    // 请求行中最先含有空格和 \t 任一字符的位置
+    const char* method_end = scan_blank(text, end);
 
     // 如果没有空格或\t，则报文格式有误
-    if (!m_url) {
+    if (method_end == end) {
         return BAD_REQUEST;
     }
 
-    // 将该位置改为\0，用于将前面数据取出
-    *m_url++ = '\0';
-
-    // 取出数据，并通过与GET和POST比较，以确定请求方式
-    char* method = text;
-
-    if (strcasecmp(method, "GET") == 0) {
+    // 按方法名长度确定请求方式, 只支持 GET 和 POST
+    m_request.method = std::string_view(text, method_end - text);
+    if (m_request.method.size() == 3 && strncasecmp(text, "GET", 3) == 0) {
         m_method = GET;
     }
-    else if (strcasecmp(method, "POST") == 0) {
+    else if (m_request.method.size() == 4 && strncasecmp(text, "POST", 4) == 0) {
         m_method = POST;
-        cgi = 1;
     }
     else {
         return BAD_REQUEST;
     }
 
-    // m_url此时跳过了第一个空格或 \t 字符，但不知道之后是否还有
-    // 将 m_url 向后偏移，通过查找，继续跳过空格和 \t 字符，
-    // 指向请求资源的第一个字符
-    m_url += strspn(m_url, " \t");
+    // 跳过之后的空格和 \t 字符，指向请求资源的第一个字符
+    const char* url = skip_blank(method_end + 1, end);
 
     // 使用与判断请求方式的相同逻辑，判断HTTP版本号
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version) {
+    const char* url_end = scan_blank(url, end);
+    if (url_end == end) {
         return BAD_REQUEST;
     }
-    *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
+    const char* version = skip_blank(url_end + 1, end);
+    m_request.version = std::string_view(version, end - version);
 
-    // 仅支持HTTP/1.1
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) {
+    // 支持HTTP/1.1和HTTP/1.0
+    // HTTP/1.1 默认为长连接, 带 Connection: close 时关闭; HTTP/1.0 带 Connection: keep-alive 时才保持连接
+    if (m_request.version.size() != 8 || strncasecmp(version, "HTTP/1.", 7) != 0 ||
+        (version[7] != '1' && version[7] != '0')) {
         return BAD_REQUEST;
     }
+    m_request.keep_alive = version[7] == '1';
 
     // 对请求资源前7个字符进行判断
     // 这里主要是有些报文的请求资源中会带有http://，这里需要对这种情况进行单独处理
-    if (strncasecmp(m_url, "http://", 7) == 0) {
-        m_url += 7;
-        m_url = strchr(m_url, '/');
+    // 同样增加https情况, 去掉协议和主机名, 只保留路径
+    std::string_view path(url, url_end - url);
+    if (path.size() >= 7 && strncasecmp(url, "http://", 7) == 0) {
+        path.remove_prefix(7);
+        path.remove_prefix(std::min(path.find('/'), path.size()));
     }
-
-    // 同样增加https情况
-    if (strncasecmp(m_url, "https://", 8) == 0) {
-        m_url += 8;
-        m_url = strchr(m_url, '/');
+    else if (path.size() >= 8 && strncasecmp(url, "https://", 8) == 0) {
+        path.remove_prefix(8);
+        path.remove_prefix(std::min(path.find('/'), path.size()));
     }
 
     // 一般的不会带有上述两种符号，直接是单独的/或/后面带访问资源
-    if (!m_url || m_url[0] != '/') {
+    if (path.empty() || path[0] != '/') {
         return BAD_REQUEST;
     }
 
     // 当url为/时，显示欢迎界面
-    if (strlen(m_url) == 1) {
-        strcat(m_url, "judge.html");
+    if (path.size() == 1) {
+        path = "/judge.html";
     }
+    m_request.url = path;
 
     // 请求行处理完毕，将主状态机转移处理请求头
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
-http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
+http_conn::HTTP_CODE http_conn::parse_headers(char* text, int len) {
 
     // 判断是空行还是请求头
-    if (text[0] == '\0') {
+    if (len == 0) {
 
         // 判断是GET还是POST请求
-        if (m_content_length != 0) {
+        if (m_request.content_length != 0) {
             // POST需要跳转到消息体处理状态
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
@@ -356,36 +460,82 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
         return GET_REQUEST;
     }
 
-    // 解析请求头部连接字段
-    else if (strncasecmp(text, "Connection:", 11) == 0) {
-        text += 11;
-
-        // 跳过空格和\t字符
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0) {
-            // 如果是长连接，则将linger标志设置为true
-            m_linger = true;
-        }
+    // 字段名到冒号为止
+    const char* end = text + len;
+    const char* colon = scan_any(text, end, ':', ':');
+    if (colon == end) {
+        LOG_DEBUG("oop!unknow header: %.*s", len, text);
+        return NO_REQUEST;
     }
 
-    // 解析请求头部内容长度字段
-    else if (strncasecmp(text, "Content-length:", 15) == 0) {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+    // 跳过冒号后的空格和\t字符, 指向字段值; 字段全部保存, 供之后的处理查找
+    std::string_view name(text, colon - text);
+    const char*      value_begin = skip_blank(colon + 1, end);
+    std::string_view value(value_begin, end - value_begin);
+    if (!m_request.add_header(name, value)) {
+        LOG_ERROR("%s", "too many headers");
+        return BAD_REQUEST;
     }
 
-    // 解析请求头部HOST字段
-    else if (strncasecmp(text, "Host:", 5) == 0) {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }
+    // 服务器用到的字段按长度查表确定
+    switch (lookup_header(name.data(), name.size())) {
+        // 解析请求头部连接字段
+        case HEADER_CONNECTION: {
+            // 值可以是以逗号分隔的多个选项, 如 "keep-alive, Upgrade"
+            while (!value.empty()) {
+                size_t           comma = std::min(value.find(','), value.size());
+                std::string_view token = value.substr(0, comma);
+                while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) {
+                    token.remove_suffix(1);
+                }
+                if (token.size() == 5 && strncasecmp(token.data(), "close", 5) == 0) {
+                    m_request.keep_alive = false;
+                }
+                else if (token.size() == 10 && strncasecmp(token.data(), "keep-alive", 10) == 0) {
+                    // 如果是长连接，则将keep_alive标志设置为true
+                    m_request.keep_alive = true;
+                }
+                value.remove_prefix(std::min(comma + 1, value.size()));
+                while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                    value.remove_prefix(1);
+                }
+            }
+            break;
+        }
 
-    else {
-        // printf("oop!unknow header: %s\n",text);
-        LOG_INFO("oop!unknow header: %s", text);
-        Log::get_instance()->flush();
+        // 解析请求头部内容长度字段, 只接受十进制数字
+        case HEADER_CONTENT_LENGTH: {
+            if (value.empty()) {
+                return BAD_REQUEST;
+            }
+            long length = 0;
+            for (size_t i = 0; i < value.size(); ++i) {
+                if (value[i] < '0' || value[i] > '9') {
+                    return BAD_REQUEST;
+                }
+                length = length * 10 + (value[i] - '0');
+                if (length > MAX_CONTENT_LENGTH) {
+                    return BAD_REQUEST;
+                }
+            }
+            m_request.content_length = length;
+            break;
+        }
+
+        // 解析请求头部HOST字段
+        case HEADER_HOST: {
+            m_request.host = value;
+            break;
+        }
+
+        // 解析请求头部 If-None-Match 字段, 与文件的 ETag 相同时返回 304
+        case HEADER_IF_NONE_MATCH: {
+            m_request.if_none_match = value;
+            break;
+        }
+
+        default:
+            break;
     }
 
     return NO_REQUEST;
@@ -394,11 +544,11 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
 http_conn::HTTP_CODE http_conn::parse_content(char* text) {
 
     // 判断http请求是否被完整读入
-    if (m_read_idx >= (m_content_length + m_checked_idx)) {
-        text[m_content_length] = '\0';
-
+    if (m_read_idx >= (m_request.content_length + m_checked_idx)) {
         // POST请求中最后为输入的用户名和密码
-        m_string = text;
+        // 请求体之后可能是流水线中的下一个请求, 只记录范围, 不修改缓冲区
+        m_request.body = std::string_view(text, m_request.content_length);
+        m_checked_idx += m_request.content_length;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -410,6 +560,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE   ret = NO_REQUEST;
     char*       text = 0;
+    int64_t     start = metrics::now_ns();
 
     // 判断条件:
     // 主状态机转移到 CHECK_STATE_CONTENT，该条件涉及解析消息体
@@ -417,21 +568,28 @@ http_conn::HTTP_CODE http_conn::process_read() {
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) ||
            ((line_status = parse_line()) == LINE_OK)) {
 
-        // 从状态机读取数据
+        // 从状态机读取数据, len 为不含 \r\n 的行长度, 解析请求体时无意义
         text = get_line();
+        int len = m_checked_idx - m_start_line - 2;
 
         // m_start_line 是每一个数据行在 m_read_buf 中的起始位置
         // m_checked_idx 表示从状态机在 m_read_buf 中读取的位置
         m_start_line = m_checked_idx;
 
-        LOG_INFO("%s", text);
-        Log::get_instance()->flush();
+        if (m_check_state != CHECK_STATE_CONTENT) {
+            LOG_DEBUG("%.*s", len, text);
+        }
 
         // 主状态机的三种状态转移逻辑
         switch (m_check_state) {
             case CHECK_STATE_REQUESTLINE: {
+                // 跳过请求之间多余的空行, 如上一个 POST 请求体后的 \r\n
+                if (len == 0) {
+                    break;
+                }
+
                 // 解析请求行
-                ret = parse_request_line(text);
+                ret = parse_request_line(text, len);
                 if (ret == BAD_REQUEST) {
                     return BAD_REQUEST;
                 }
@@ -440,13 +598,14 @@ http_conn::HTTP_CODE http_conn::process_read() {
             case CHECK_STATE_HEADER: {
 
                 // 解析请求头
-                ret = parse_headers(text);
+                ret = parse_headers(text, len);
                 if (ret == BAD_REQUEST) {
                     return BAD_REQUEST;
                 }
 
                 // 完整解析GET请求后，跳转到报文响应函数
                 else if (ret == GET_REQUEST) {
+                    metrics::record(metrics::PARSE, metrics::now_ns() - start);
                     return do_request();
                 }
                 break;
@@ -457,12 +616,13 @@ http_conn::HTTP_CODE http_conn::process_read() {
 
                 // 完整解析POST请求后，跳转到报文响应函数
                 if (ret == GET_REQUEST) {
+                    metrics::record(metrics::PARSE, metrics::now_ns() - start);
                     return do_request();
                 }
 
-                // 解析完消息体即完成报文解析，避免再次进入循环，更新line_status
-                line_status = LINE_OPEN;
-                break;
+                // 消息体尚未接收完整, 直接返回等待继续读取
+                // 不能再进入循环, 否则从状态机会把消息体当作行扫描, 移动 m_checked_idx
+                return NO_REQUEST;
             }
             default:
                 return INTERNAL_ERROR;
@@ -472,171 +632,306 @@ http_conn::HTTP_CODE http_conn::process_read() {
 }
 
 http_conn::HTTP_CODE http_conn::do_request() {
+    // 按请求方法和路径查找路由, 交给对应的处理函数
+    route_params                params;
+    const http_conn_router::route* route = router().match(m_method, m_request.url, params);
+    if (!route) {
+        return NO_RESOURCE;
+    }
+    return (this->*route->handler)(route->arg, params);
+}
 
-    // 网站根目录, 文件夹内存放请求的资源和跳转的 html 文件
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-
-    // 找到 m_url 中 / 的位置
-    const char* p = strrchr(m_url, '/');
-
-    // 实现登录和注册校验
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3')) {
-
-        // 根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        // 将用户名和密码提取出来
-        // user=123&passwd=123
-        char name[100], password[100];
-
-        // 以&为分隔符，前面的为用户名
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i) {
-            name[i - 5] = m_string[i];
-        }
-        name[i - 5] = '\0';
-
-        // 以&为分隔符，后面的是密码
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j) {
-            password[j] = m_string[i];
-        }
-        password[j] = '\0';
-
-        // 同步线程登录校验
-        if (*(p + 1) == '3') {
-            // 如果是注册，先检测数据库中是否有重名的
-            // 没有重名的，进行增加数据
-            char* sql_insert = (char*)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            // 判断map中能否找到重复的用户名
-            if (users.find(name) == users.end()) {
-                // 向数据库中插入数据时，需要通过锁来同步数据
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                // 校验成功，跳转登录页面
-                if (!res) {
-                    strcpy(m_url, "/log.html");
-                }
-                // 校验失败，跳转注册失败页面
-                else {
-                    strcpy(m_url, "/registerError.html");
-                }
-            }
-            else {
-                strcpy(m_url, "/registerError.html");
-            }
-        }
-        // 如果是登录，直接判断
-        // 若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2') {
-            if (users.find(name) != users.end() && users[name] == password) {
-                strcpy(m_url, "/welcome.html");
-            }
-            else {
-                strcpy(m_url, "/logError.html");
-            }
-        }
+const http_conn::http_conn_router& http_conn::router() {
+    // 函数内的静态对象只初始化一次, 由编译器保证线程安全
+    static http_conn_router routes = build_router();
+    return routes;
+}
+
+http_conn::http_conn_router http_conn::build_router() {
+    http_conn_router routes;
+
+    // 页面跳转, 页面中的表单以 POST 提交, 也接受 GET
+    // /0 注册界面, /1 登录界面, /5 图片页面, /6 视频页面, /7 关注页面
+    const char* pages[][2] = {
+        {"/0", "/register.html"}, {"/1", "/log.html"},  {"/5", "/picture.html"},
+        {"/6", "/video.html"},    {"/7", "/fans.html"},
+    };
+    for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); ++i) {
+        routes.add(GET, pages[i][0], &http_conn::serve_page, pages[i][1]);
+        routes.add(POST, pages[i][0], &http_conn::serve_page, pages[i][1]);
     }
 
-    // 如果请求资源为/0，表示跳转注册界面
-    if (*(p + 1) == '0') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
+    // 登录和注册校验
+    routes.add(POST, "/2CGISQL.cgi", &http_conn::login);
+    routes.add(POST, "/3CGISQL.cgi", &http_conn::register_user);
+
+    // 运行指标
+    routes.add(GET, "/metrics", &http_conn::serve_metrics);
+
+    // 其余路径发送 url 实际请求的文件
+    routes.add(GET, "/*", &http_conn::serve_static);
+    routes.add(POST, "/*", &http_conn::serve_static);
+    return routes;
+}
 
-        // 将网站目录和/register.html进行拼接，更新到m_real_file中
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+void http_conn::init_routes() { router(); }
 
-        free(m_url_real);
+bool http_conn::parse_credentials(std::string_view& name, std::string_view& password) {
+    // 将用户名和密码提取出来
+    // user=123&password=123
+    // 以&为分隔符，前面的为用户名，后面的是密码
+    std::string_view body = m_request.body;
+    size_t           amp = body.find('&');
+    if (body.size() < 5 || amp == std::string_view::npos || amp + 10 > body.size()) {
+        return false;
     }
+    name = body.substr(5, amp - 5);
+    password = body.substr(amp + 10);
+    return name.size() < 100 && password.size() < 100;
+}
 
-    // 如果请求资源为/1，表示跳转登录界面
-    else if (*(p + 1) == '1') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
+// 在内存中查找用户, 懒加载模式下缓存未命中时返回 USER_UNKNOWN
+static USER_STATE find_user(std::string_view name, std::string_view password) {
+#ifdef LAZY_USER_LOAD
+    return user_cache::get_instance()->check(name, password);
+#else
+    // 用户索引的查找不加锁, 不受同时进行的注册影响
+    user_store* store = user_store::get_instance();
+    if (store->check(name, password)) {
+        return USER_MATCH;
+    }
+    return store->contains(name) ? USER_MISMATCH : USER_ABSENT;
+#endif
+}
 
-        // 将网站目录和/register.html进行拼接，更新到m_real_file中
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+// 记住新注册的用户
+static void remember_user(std::string_view name, std::string_view password) {
+#ifdef LAZY_USER_LOAD
+    user_cache::get_instance()->put(name, password);
+#else
+    user_store::get_instance()->insert(name, password);
+#endif
+}
 
-        free(m_url_real);
+http_conn::HTTP_CODE http_conn::login(const char*, const route_params&) {
+    std::string_view name, password;
+    if (!parse_credentials(name, password)) {
+        return BAD_REQUEST;
     }
-    // 图片页面
-    else if (*(p + 1) == '5') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
+    // 若浏览器端输入的用户名和密码在表中可以查找到，跳转欢迎界面，否则跳转登录失败页面
+    // 缓存未命中时交给数据库线程按用户名查询
+    switch (find_user(name, password)) {
+        case USER_MATCH:
+            return serve_file("/welcome.html");
+        case USER_UNKNOWN:
+            m_db_handler = &http_conn::login_in_db;
+            return DB_PENDING;
+        default:
+            return serve_file("/logError.html");
     }
-    // 视频页面
-    else if (*(p + 1) == '6') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+}
+
+http_conn::HTTP_CODE http_conn::login_in_db(MYSQL* mysql) {
+    std::string_view name, password;
+    parse_credentials(name, password);
 
-        free(m_url_real);
+    // 用预先准备的语句查询, 用户名作为参数传入
+    std::string stored;
+    int         found = connection_pool::GetInstance()->SelectUser(mysql, name, stored);
+    if (found < 0) {
+        return serve_file("/logError.html");
     }
-    // 关注页面
-    else if (*(p + 1) == '7') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
+    // 查询结果放入缓存, 不存在的用户也缓存, 避免重复查询
+    if (found) {
+        user_cache::get_instance()->put(name, stored);
     }
-    // 否则发送url实际请求的文件
     else {
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+        user_cache::get_instance()->put_absent(name);
     }
+    return serve_file(found && password == stored ? "/welcome.html" : "/logError.html");
+}
 
-    // 通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
-    // 失败返回NO_RESOURCE状态，表示资源不存在
-    if (stat(m_real_file, &m_file_stat) < 0) {
-        return NO_RESOURCE;
+http_conn::HTTP_CODE http_conn::register_user(const char*, const route_params&) {
+    std::string_view name, password;
+    if (!parse_credentials(name, password)) {
+        return BAD_REQUEST;
     }
 
-    // 判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态
-    if (!(m_file_stat.st_mode & S_IROTH)) {
-        return FORBIDDEN_REQUEST;
+    // 如果是注册，先检测内存中是否有重名的
+    // 有重名的，不访问数据库，直接跳转注册失败页面
+    USER_STATE state = find_user(name, password);
+    if (state == USER_MATCH || state == USER_MISMATCH) {
+        return serve_file("/registerError.html");
     }
 
-    // 判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
-    if (S_ISDIR(m_file_stat.st_mode)) {
-        return BAD_REQUEST;
+    // 没有重名或缓存未命中的，交给数据库线程查询并增加数据
+    m_db_handler = &http_conn::register_in_db;
+    return DB_PENDING;
+}
+
+http_conn::HTTP_CODE http_conn::register_in_db(MYSQL* mysql) {
+    std::string_view name, password;
+    parse_credentials(name, password);
+
+    // 排队期间可能已有同名用户注册
+    USER_STATE state = find_user(name, password);
+    if (state == USER_MATCH || state == USER_MISMATCH) {
+        return serve_file("/registerError.html");
     }
 
-    // 以只读方式获取文件描述符，通过mmap将该文件映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // 缓存未命中不代表用户不存在, 先按用户名查询, 已存在的放入缓存并返回注册失败
+    connection_pool* pool = connection_pool::GetInstance();
+    std::string      stored;
+    int              found = pool->SelectUser(mysql, name, stored);
+    // 查询出错时 SelectUser 已记录错误
+    if (found != 0) {
+        if (found > 0) {
+            remember_user(name, stored);
+        }
+        return serve_file("/registerError.html");
+    }
 
-    // 避免文件描述符的浪费和占用
-    close(fd);
+    // 用预先准备的语句插入, 查询只阻塞数据库线程
+    // 同时注册的同名用户由表上的唯一键拒绝
+    // 校验成功，记入用户索引，跳转登录页面; 校验失败，跳转注册失败页面
+    if (pool->InsertUsers(mysql, &name, &password, 1) > 0) {
+        remember_user(name, password);
+        return serve_file("/log.html");
+    }
+    return serve_file("/registerError.html");
+}
+
+bool http_conn::db_batchable() const { return m_db_handler == &http_conn::register_in_db; }
+
+void http_conn::process_db_batch(MYSQL* mysql, http_conn** requests, int count) {
+    // 超时未取得数据库连接时全部返回内部错误
+    if (!mysql) {
+        for (int i = 0; i < count; ++i) {
+            requests[i]->m_db_handler = NULL;
+            requests[i]->process_requests(INTERNAL_ERROR);
+        }
+        return;
+    }
+
+    // 合并的注册请求用一条多行 INSERT 提交, 超过单条语句行数上限时分批
+    while (count > connection_pool::MAX_INSERT_ROWS) {
+        process_db_batch(mysql, requests, connection_pool::MAX_INSERT_ROWS);
+        requests += connection_pool::MAX_INSERT_ROWS;
+        count -= connection_pool::MAX_INSERT_ROWS;
+    }
+
+    connection_pool* pool = connection_pool::GetInstance();
+    std::string_view names[connection_pool::MAX_INSERT_ROWS];
+    std::string_view passwords[connection_pool::MAX_INSERT_ROWS];
+    http_conn*       pending[connection_pool::MAX_INSERT_ROWS];
+    int              rows = 0;
+    for (int i = 0; i < count; ++i) {
+        http_conn* request = requests[i];
+        request->m_db_handler = NULL;
+        request->parse_credentials(names[rows], passwords[rows]);
+
+        // 内存中已有同名用户的直接失败, 不进入 INSERT; 缓存未命中的先按用户名查询
+        // 批内重名的只保留第一个, 其余失败
+        USER_STATE state = find_user(names[rows], passwords[rows]);
+        bool       taken = state == USER_MATCH || state == USER_MISMATCH;
+        for (int j = 0; j < rows && !taken; ++j) {
+            taken = names[j] == names[rows];
+        }
+        if (!taken && state == USER_UNKNOWN) {
+            std::string stored;
+            int         found = pool->SelectUser(mysql, names[rows], stored);
+            if (found > 0) {
+                remember_user(names[rows], stored);
+            }
+            taken = found != 0;
+        }
+        if (taken) {
+            request->process_requests(request->serve_file("/registerError.html"));
+            continue;
+        }
+        pending[rows++] = request;
+    }
+
+    // 整条语句失败时(如数据库中已有同名用户)逐条重试, 以确定每个请求的结果
+    bool all = rows > 1 && pool->InsertUsers(mysql, names, passwords, rows) > 0;
+    for (int i = 0; i < rows; ++i) {
+        bool ok = all || pool->InsertUsers(mysql, &names[i], &passwords[i], 1) > 0;
+        if (ok) {
+            remember_user(names[i], passwords[i]);
+        }
+        pending[i]->process_requests(
+            pending[i]->serve_file(ok ? "/log.html" : "/registerError.html"));
+    }
+}
+
+http_conn::HTTP_CODE http_conn::serve_page(const char* page, const route_params&) {
+    return serve_file(page);
+}
+
+http_conn::HTTP_CODE http_conn::serve_static(const char*, const route_params&) {
+    return serve_file(m_request.url);
+}
+
+http_conn::HTTP_CODE http_conn::serve_file(std::string_view url) {
+    // 网站根目录, 文件夹内存放请求的资源和跳转的 html 文件
+    // 将网站目录和 url 拼接到 m_real_file 中, 不再为每个路由申请临时缓冲区
+    m_request.url = url;
+    snprintf(m_real_file, FILENAME_LEN, "%s%.*s", doc_root, (int)url.size(), url.data());
+
+    // 从文件缓存取出请求的文件, 未命中或需要校验修改时间时才访问文件系统
+    switch (file_cache::get_instance()->acquire(m_real_file, m_file)) {
+        // 资源不存在
+        case file_cache::NOT_FOUND:
+            return NO_RESOURCE;
+        // 文件不可读
+        case file_cache::FORBIDDEN:
+            return FORBIDDEN_REQUEST;
+        // 请求的是目录，表示请求报文有误
+        case file_cache::IS_DIRECTORY:
+            return BAD_REQUEST;
+        case file_cache::LOAD_ERROR:
+            return INTERNAL_ERROR;
+        default:
+            break;
+    }
+
+    // 浏览器缓存的版本与文件相同
+    if (!m_request.if_none_match.empty() && m_file->etag == m_request.if_none_match) {
+        return NOT_MODIFIED;
+    }
 
     // 表示请求文件存在，且可以访问
     return FILE_REQUEST;
 }
 
-void http_conn::unmap() {
-    if (m_file_address) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+http_conn::HTTP_CODE http_conn::serve_metrics(const char*, const route_params&) {
+    // 只允许本机抓取, 其他地址按不存在处理
+    if ((ntohl(m_address.sin_addr.s_addr) >> 24) != 127) {
+        return NO_RESOURCE;
     }
+
+    // 正文放入不属于文件缓存的条目, 随响应一起释放
+    std::string text = metrics::get_instance()->render();
+    std::shared_ptr<cached_file> page = std::make_shared<cached_file>();
+    page->data = new char[text.size()];
+    memcpy(page->data, text.data(), text.size());
+    page->size = text.size();
+
+    char buf[128];
+    snprintf(
+        buf, sizeof(buf),
+        "HTTP/1.1 200 OK\r\nContent-Type:text/plain; version=0.0.4\r\nContent-Length:%ld\r\n",
+        (long)page->size);
+    page->headers = buf;
+    m_file = page;
+    return FILE_REQUEST;
+}
+
+void http_conn::close_file() {
+    // 只释放对缓存条目的引用, 文件由缓存关闭
+    m_file.reset();
 }
 
 bool http_conn::write() {
@@ -651,9 +946,54 @@ bool http_conn::write() {
     }
 
     while (1) {
+        response* head = &m_responses[m_response_head];
+
+        // 队首响应的头部已发送完, 正文是缓存了描述符的大文件, 由 sendfile 发送
+        // 缓存的描述符由多个连接共用, 各自的偏移量不影响文件位置
+        if (m_response_sent >= head->header_len && head->file && head->file->fd != -1) {
+            off_t offset = m_response_sent - head->header_len;
+            temp = sendfile(m_sockfd, head->file->fd, &offset, head->body_len - offset);
+
+            // 文件在发送期间被截短, 无法发送完声明的长度
+            if (temp == 0) {
+                release_responses();
+                return false;
+            }
+        }
+        // 从队首开始, 把各响应的头部和内存中的正文组成 iovec 一次发送
+        // 遇到大文件正文时停下, 带 MSG_MORE 让内核把头部和随后 sendfile 的数据合并成满的报文段
+        else {
+            struct iovec iv[2 * MAX_PIPELINE];
+            int          count = 0;
+            int          flags = 0;
+            off_t        sent = m_response_sent;
+            for (int i = m_response_head; i < m_response_count; ++i) {
+                response* r = &m_responses[i];
+                if (sent < r->header_len) {
+                    iv[count].iov_base = m_write_buf + r->header_begin + sent;
+                    iv[count].iov_len = r->header_len - sent;
+                    ++count;
+                }
+                if (r->file && r->file->fd != -1) {
+                    flags = MSG_MORE;
+                    break;
+                }
+                off_t body_sent = sent > r->header_len ? sent - r->header_len : 0;
+                if (r->file && body_sent < r->body_len) {
+                    iv[count].iov_base = r->file->data + body_sent;
+                    iv[count].iov_len = r->body_len - body_sent;
+                    ++count;
+                }
+                sent = 0;
+            }
+
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iv;
+            msg.msg_iovlen = count;
+            temp = sendmsg(m_sockfd, &msg, flags);
+        }
 
-        // 将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
-        temp = writev(m_sockfd, m_iv, m_iv_count);
         if (temp < 0) {
 
             // 判断缓冲区是否满了
@@ -662,49 +1002,102 @@ bool http_conn::write() {
                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
-            // 如果发送失败，但不是缓冲区问题，取消映射
-            unmap();
+            // 如果发送失败，但不是缓冲区问题，释放各响应引用的文件
+            release_responses();
             return false;
         }
 
         // 更新已发送字节数
         bytes_have_send += temp;
         bytes_to_send -= temp;
-
-        // 第一个iovec头部信息的数据已发送完，发送第二个iovec数据
-        if (bytes_have_send >= m_iv[0].iov_len) {
-
-            // 不再继续发送头部信息
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+        metrics::add(metrics::BYTES_SENT, temp);
+        if (m_accept_ns) {
+            metrics::record(metrics::ACCEPT_TO_FIRST_BYTE, metrics::now_ns() - m_accept_ns);
+            m_accept_ns = 0;
         }
-        // 继续发送第一个iovec头部信息的数据
-        else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+
+        // 把已发送的字节依次计入队列中的响应, 发送完的响应出队
+        off_t left = temp;
+        while (m_response_head < m_response_count) {
+            response* r = &m_responses[m_response_head];
+            off_t     remain = r->header_len + r->body_len - m_response_sent;
+            if (left < remain) {
+                m_response_sent += left;
+                break;
+            }
+            left -= remain;
+            r->file.reset();
+            ++m_response_head;
+            m_response_sent = 0;
         }
 
         // 判断条件，数据已全部发送完
         if (bytes_to_send <= 0) {
-            unmap();
+            // 最后一个响应对应的请求决定连接是否保持
+            bool linger = m_responses[m_response_count - 1].linger;
+            release_responses();
 
-            // 在epoll树上重置EPOLLONESHOT事件
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            int64_t now = metrics::now_ns();
+            if (m_request_ns) {
+                metrics::record(metrics::TIME_TO_LAST_BYTE, now - m_request_ns);
+            }
+            m_request_ns = 0;
 
             // 浏览器的请求为长连接
-            if (m_linger) {
-                // 重新初始化HTTP对象
+            if (linger) {
+                // 缓冲区中还有流水线发来的后续请求, 移到缓冲区开头, 交给调用方继续解析
+                // 此时不重置 EPOLLONESHOT, 避免解析期间再次触发读事件
+                if (m_read_idx > m_start_line || m_check_state != CHECK_STATE_REQUESTLINE) {
+                    m_request_ns = now;
+                    next_connection_round();
+                    return true;
+                }
+
+                // 重新初始化HTTP对象, 先于重置事件, 避免其他线程读到未初始化的状态
                 init();
+
+                // 在epoll树上重置EPOLLONESHOT事件
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
                 return true;
             }
             else {
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
+                free_buffers();
                 return false;
             }
         }
     }
 }
 
+void http_conn::release_responses() {
+    for (int i = 0; i < m_response_count; ++i) {
+        m_responses[i].file.reset();
+    }
+    m_response_head = 0;
+    m_response_count = 0;
+    m_response_sent = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+}
+
+void http_conn::next_connection_round() {
+    m_pipelined = true;
+
+    // 下一个请求已部分解析, 解析结果指向当前缓冲区, 原样保留
+    // 分配失败时同样保留原缓冲区, 下标不变
+    int pending = m_read_idx - m_start_line;
+    int checked = m_checked_idx - m_start_line;
+    if (m_check_state != CHECK_STATE_REQUESTLINE || !m_read_chain.compact(m_start_line, m_read_idx)) {
+        return;
+    }
+    m_read_buf = m_read_chain.data();
+    m_read_size = m_read_chain.capacity();
+    m_start_line = 0;
+    m_checked_idx = checked;
+    m_read_idx = pending;
+}
+
 bool http_conn::add_response(const char* format, ...) {
 
     // 如果写入内容超出m_write_buf大小则报错
@@ -734,8 +1127,7 @@ bool http_conn::add_response(const char* format, ...) {
     // 清空可变参列表
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
-    Log::get_instance()->flush();
+    LOG_DEBUG("request:%s", m_write_buf);
 
     return true;
 }
@@ -745,9 +1137,7 @@ bool http_conn::add_status_line(int status, const char* title) {
 }
 
 bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_blank_line();
 }
 
 bool http_conn::add_content_length(int content_len) {
@@ -757,7 +1147,7 @@ bool http_conn::add_content_length(int content_len) {
 bool http_conn::add_content_type() { return add_response("Content-Type:%s\r\n", "text/html"); }
 
 bool http_conn::add_linger() {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    return add_response("Connection:%s\r\n", m_request.keep_alive ? "keep-alive" : "close");
 }
 
 bool http_conn::add_blank_line() { return add_response("%s", "\r\n"); }
@@ -765,6 +1155,9 @@ bool http_conn::add_blank_line() { return add_response("%s", "\r\n"); }
 bool http_conn::add_content(const char* content) { return add_response("%s", content); }
 
 bool http_conn::process_write(HTTP_CODE ret) {
+    // 本响应的头部从写缓冲区当前位置开始, 排在之前的流水线响应之后
+    int header_begin = m_write_idx;
+
     switch (ret) {
 
         // 内部错误，500
@@ -779,8 +1172,20 @@ bool http_conn::process_write(HTTP_CODE ret) {
             break;
         }
 
-        // 报文语法有误，404
-        case BAD_REQUEST: {
+        // 服务器过载，503，Retry-After 告知客户端多久之后重试
+        case SERVICE_UNAVAILABLE: {
+            add_status_line(503, error_503_title);
+            add_response("Retry-After:%d\r\n", RETRY_AFTER);
+            add_headers(strlen(error_503_form));
+            if (!add_content(error_503_form)) {
+                return false;
+            }
+            break;
+        }
+
+        // 报文语法有误或请求资源不存在，404
+        case BAD_REQUEST:
+        case NO_RESOURCE: {
             add_status_line(404, error_404_title);
             add_headers(strlen(error_404_form));
             if (!add_content(error_404_form)) {
@@ -801,27 +1206,19 @@ bool http_conn::process_write(HTTP_CODE ret) {
 
         // 文件存在，200
         case FILE_REQUEST: {
-            add_status_line(200, ok_200_title);
-
             // 如果请求的资源存在
-            if (m_file_stat.st_size != 0) {
-                add_headers(m_file_stat.st_size);
-
-                // 第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
-
-                // 第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-
-                // 发送的全部数据为响应报文头部信息和文件大小
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
-
-                return true;
+            if (m_file->size != 0) {
+                // 状态行、Content-Length 与 ETag 由文件缓存预先生成
+                // 文件内容在缓存中或由 sendfile 发送
+                if (!add_response("%s", m_file->headers.c_str()) || !add_linger() ||
+                    !add_blank_line()) {
+                    return false;
+                }
             }
             else {
+                close_file();
+                add_status_line(200, ok_200_title);
+
                 // 如果请求的资源大小为0，则返回空白html文件
                 const char* ok_string = "<html><body></body></html>";
                 add_headers(strlen(ok_string));
@@ -829,35 +1226,97 @@ bool http_conn::process_write(HTTP_CODE ret) {
                     return false;
                 }
             }
+            break;
+        }
+
+        // 文件未修改，304，不发送响应正文
+        case NOT_MODIFIED: {
+            add_status_line(304, not_modified_304_title);
+            add_response("ETag:%s\r\n", m_file->etag.c_str());
+            if (!add_linger() || !add_blank_line()) {
+                return false;
+            }
+            close_file();
+            break;
         }
         default:
             return false;
     }
 
-    // 除FILE_REQUEST状态外，其余状态只申请一个iovec，指向响应报文缓冲区
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    // 响应加入发送队列, 正文文件的引用转移给队列
+    response* r = &m_responses[m_response_count++];
+    r->header_begin = header_begin;
+    r->header_len = m_write_idx - header_begin;
+    r->file = m_file;
+    r->body_len = m_file ? m_file->size : 0;
+    r->linger = m_request.keep_alive;
+    close_file();
+
+    bytes_to_send += r->header_len + r->body_len;
     return true;
 }
 
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();
+    m_pipelined = false;
+    process_requests(process_read());
+}
 
-    // NO_REQUEST，表示请求不完整，需要继续接收请求数据
-    if (read_ret == NO_REQUEST) {
-        // 注册并监听读事件
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
-    }
+void http_conn::reject() {
+    metrics::add(metrics::REJECTED, 1);
+    process_requests(SERVICE_UNAVAILABLE);
+}
 
-    // 调用 process_write 完成报文响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) {
-        close_conn();
+void http_conn::process_db(MYSQL* mysql) {
+    // 在数据库线程中完成查询, 之后的流程与工作线程相同
+    // 超时未取得数据库连接时返回内部错误
+    db_handler handler = m_db_handler;
+    m_db_handler = NULL;
+    process_requests(mysql ? (this->*handler)(mysql) : INTERNAL_ERROR);
+}
+
+void http_conn::process_requests(HTTP_CODE read_ret) {
+    // 依次解析缓冲区中流水线发来的完整请求, 响应按请求顺序排队, 由 write 一并发送
+    while (1) {
+        // NO_REQUEST，表示请求不完整，需要继续接收请求数据
+        if (read_ret == NO_REQUEST) {
+            break;
+        }
+
+        // 请求需要访问数据库, 交给数据库线程, 完成后由 process_db 继续
+        // 交出后本线程不能再访问该连接; 持有计数随连接交给数据库线程, 由其交还
+        if (read_ret == DB_PENDING) {
+            if (m_db_worker && m_db_worker->append(this)) {
+                return;
+            }
+            m_db_handler = NULL;
+            read_ret = INTERNAL_ERROR;
+        }
+
+        // 报文有误或未解析时无法确定下一个请求的位置, 响应后关闭连接
+        if (read_ret == BAD_REQUEST || read_ret == SERVICE_UNAVAILABLE) {
+            m_request.keep_alive = false;
+        }
+
+        // 调用 process_write 完成报文响应
+        bool write_ret = process_write(read_ret);
+        if (!write_ret) {
+            close_conn();
+            release_busy();
+            return;
+        }
+
+        // 非长连接的请求之后不再处理, 响应队列或写缓冲区将满时等发送完再继续解析
+        bool more = m_request.keep_alive && m_response_count < MAX_PIPELINE &&
+                    WRITE_BUFFER_SIZE - m_write_idx >= PIPELINE_RESERVE;
+        init_request();
+        if (!more) {
+            break;
+        }
+        read_ret = process_read();
     }
 
-    // 注册并监听写事件
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    // 没有完整的请求时注册并监听读事件, 否则注册并监听写事件
+    // 先注册再交还: 交还之前定时器不会关闭连接, m_sockfd 不会被新连接复用
+    modfd(m_epollfd, m_sockfd, m_response_count == 0 ? EPOLLIN : EPOLLOUT);
+    release_busy();
 }
@@ -30,17 +30,28 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+
+#include "../CGImysql/db_worker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../lock/locker.h"
+#include "../memory/chain_buffer.h"
+#include "../memory/object_pool.h"
+#include "file_cache.h"
+#include "http_request.h"
+#include "http_router.h"
 
 // http 类
 // 通过该类创建对象用于接收客户端 http 请求
 // 并将所有数据读入对应 buffer
 class http_conn {
 public:
-    static const int FILENAME_LEN = 200;       // 设置读取文件的名称 m_real_file 大小
-    static const int READ_BUFFER_SIZE = 2048;  // 设置读缓冲区 m_read_buf 大小
-    static const int WRITE_BUFFER_SIZE = 1024; // 设置写缓冲区 m_write_buf 大小
+    static const int FILENAME_LEN = 200;            // 设置读取文件的名称 m_real_file 大小
+    static const int WRITE_BUFFER_SIZE = 4096;      // 设置写缓冲区 m_write_buf 大小
+    static const int MAX_CONTENT_LENGTH = 1 << 20;  // 允许的最大请求体长度
+    static const int MAX_PIPELINE = 16;             // 一次最多排队的流水线响应数
+    static const int PIPELINE_RESERVE = 512;        // 写缓冲区剩余少于该值时不再解析下一个请求
+    static const int RETRY_AFTER = 1;               // 过载时建议客户端重试的秒数
 
     // 报文的请求方法, 本项目只用到 GET 和 POST
     enum METHOD { GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT, PATH };
@@ -51,12 +62,15 @@ public:
 
     // 服务器处理 HTTP 请求的结果
     enum HTTP_CODE {
-        NO_REQUEST,        // 请求不完整, 需要继续读取请求报文数据
-        GET_REQUEST,       // 获得一个完整的 HTTP 请求
-        BAD_REQUEST,       // HTTP 请求有语法错误
-        NO_RESOURCE,       // 请求资源不存在
-        FORBIDDEN_REQUEST, // 客户对资源没有足够的访问权限
-        FILE_REQUEST,      // 请求资源可以正常访问
+        NO_REQUEST,          // 请求不完整, 需要继续读取请求报文数据
+        GET_REQUEST,         // 获得一个完整的 HTTP 请求
+        BAD_REQUEST,         // HTTP 请求有语法错误
+        NO_RESOURCE,         // 请求资源不存在
+        FORBIDDEN_REQUEST,   // 客户对资源没有足够的访问权限
+        FILE_REQUEST,        // 请求资源可以正常访问
+        NOT_MODIFIED,        // 请求资源与浏览器缓存的版本相同
+        DB_PENDING,          // 请求已交给数据库线程, 查询完成后再生成响应
+        SERVICE_UNAVAILABLE, // 服务器过载, 请求未被处理
         INTERNAL_ERROR, // 服务器内部错误，该结果在主状态机逻辑 switch 的 default 下，一般不会触发
         CLOSED_CONNECTION // 客户端已经关闭连接
     };
@@ -66,13 +80,32 @@ public:
     // 读取到一个完整的行、行出错、行数据尚不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
+    // 读写缓冲区, 连接开始读请求时从对象池取出, 响应发送完或连接关闭时归还
+    // 空闲的长连接不占用缓冲区
+    struct write_block {
+        char data[WRITE_BUFFER_SIZE];
+    };
+
+    // 排队等待发送的响应, 头部在写缓冲区中, 正文为缓存的文件
+    struct response {
+        int                          header_begin; // 头部在写缓冲区中的起始位置
+        int                          header_len;   // 头部长度
+        std::shared_ptr<cached_file> file;         // 正文文件, 没有正文时为空
+        off_t                        body_len;     // 正文长度
+        bool                         linger;       // 对应请求是否保持连接
+    };
+
 public:
-    http_conn() {}
+    http_conn()
+        : m_sockfd(-1), m_read_buf(NULL), m_read_size(0), m_write_buf(NULL), m_response_count(0),
+          m_response_head(0), m_response_sent(0), m_pipelined(false), m_accept_ns(0),
+          m_request_ns(0), m_queued_ns(0), m_busy(0) {}
     ~http_conn() {}
 
 public:
     // 初始化套接字地址, 函数内部会调用私有方法 init
-    void init(int sockfd, const sockaddr_in& addr);
+    // epollfd 为连接所属的内核事件表, 多 Reactor 模式下每个子反应堆各有一个
+    void init(int sockfd, const sockaddr_in& addr, int epollfd);
 
     // 关闭 http 连接
     void close_conn(bool real_close = true);
@@ -80,41 +113,126 @@ public:
     // 报文解析
     void process();
 
+    // 线程池过载、拒绝该连接上的请求时调用, 不解析请求, 回复 503 后关闭连接
+    // 调用方须持有该连接, 即连接不在任何队列中
+    void reject();
+
+    // 数据库线程调用, 完成交给数据库线程的请求, 继续处理之后的流水线请求
+    void process_db(MYSQL* mysql);
+
+    // 交给数据库线程的请求能否与其他请求合并提交, 目前只有注册可以
+    bool db_batchable() const;
+
+    // 数据库线程调用, 把多个注册请求合并为一条多行 INSERT 提交, 再分别继续处理
+    static void process_db_batch(MYSQL* mysql, http_conn** requests, int count);
+
     // 读取浏览器端发来的全部数据
     // 循环读取客户数据, 直到无数据可读或对方关闭连接
     bool read_once();
 
     // 响应报文写入函数
+    // 流水线中的响应发送完、缓冲区还有后续请求时返回 true, 且 has_pipelined_request 为真
     bool write();
 
+    // 缓冲区中还有已读入的后续请求, 调用方应再次调用 process, 而不是等待读事件
+    bool has_pipelined_request() const { return m_pipelined; }
+
+    // 事件循环调用 process 或把连接交给工作线程前调用, 处理线程注册好下一个事件或关闭连接后减一
+    // 注册事件后事件循环可能在处理线程减一之前再次交出连接, 计数保证后一次持有不被前一次的清除覆盖
+    void set_busy() { m_busy.fetch_add(1, std::memory_order_relaxed); }
+
+    // 连接正由工作线程或数据库线程持有, 定时器此时不能关闭连接、释放其缓冲区
+    bool busy() const { return m_busy.load(std::memory_order_acquire) > 0; }
+
     sockaddr_in* get_address() { return &m_address; }
 
-    // 同步线程初始化数据库读取表
-    void initmysql_result(connection_pool* connPool);
+    // 放入线程池请求队列的时间, 由线程池统计排队时间
+    void    set_queued_ns(int64_t ns) { m_queued_ns = ns; }
+    int64_t queued_ns() const { return m_queued_ns; }
+
+    // 同步线程初始化数据库读取表, 懒加载模式下只启动后台预加载
+    static void initmysql_result(connection_pool* connPool);
+
+    // 启动时编译路由表, 不调用时在第一个请求到来时编译
+    static void init_routes();
+
+    // 设置处理注册等请求的数据库线程
+    static void set_db_worker(db_worker<http_conn>* worker) { m_db_worker = worker; }
 
 private:
     // 初始化新接受的连接
     void init();
 
+    // 重置单个请求的解析状态, 下一个请求从当前请求结束处开始, 保留缓冲区中已读入的数据
+    void init_request();
+
+    // 释放响应队列引用的文件, 清空写缓冲区
+    void release_responses();
+
+    // 响应全部发送完, 把缓冲区中剩余的流水线请求移到新段开头
+    void next_connection_round();
+
     // 从 m_read_buf 读取, 并处理请求报文
     HTTP_CODE process_read();
 
     // 向 m_write_buf 写入响应报文数据
     bool process_write(HTTP_CODE ret);
 
-    // 主状态机解析报文中的请求行数据
+    // 主状态机解析报文中的请求行数据, len 为不含行尾的长度
     // 解析 http 请求行，获得请求方法，目标 url 及 http 版本号
-    HTTP_CODE parse_request_line(char* text);
+    HTTP_CODE parse_request_line(char* text, int len);
 
-    // 主状态机解析报文中的请求头部数据
-    HTTP_CODE parse_headers(char* text);
+    // 主状态机解析报文中的请求头部数据, len 为不含行尾的长度
+    HTTP_CODE parse_headers(char* text, int len);
 
     // 主状态机解析报文中的请求内容
     HTTP_CODE parse_content(char* text);
 
-    // 生成响应报文
+    // 按路由分派请求, 生成响应报文
     HTTP_CODE do_request();
 
+    /* 路由处理函数, arg 为注册路由时给定的参数 */
+
+    // 路由表, 处理函数为 http_conn 的成员函数
+    typedef HTTP_CODE (http_conn::*route_handler)(const char* arg, const route_params& params);
+    typedef http_router<route_handler> http_conn_router;
+
+    static const http_conn_router& router();
+    static http_conn_router        build_router();
+
+    // 登录校验, 成功跳转欢迎界面
+    HTTP_CODE login(const char* arg, const route_params& params);
+
+    // 在数据库线程中按用户名查询, 结果放入用户缓存
+    HTTP_CODE login_in_db(MYSQL* mysql);
+
+    // 注册, 检查重名后交给数据库线程
+    HTTP_CODE register_user(const char* arg, const route_params& params);
+
+    // 在数据库线程中插入用户, 成功跳转登录界面
+    HTTP_CODE register_in_db(MYSQL* mysql);
+
+    // 处理解析出的请求, 生成响应并排队, 直到请求不完整或需要等待数据库线程
+    void process_requests(HTTP_CODE read_ret);
+
+    // 注册好下一个事件或关闭连接后交还事件循环, 与 set_busy 成对
+    void release_busy() { m_busy.fetch_sub(1, std::memory_order_release); }
+
+    // 跳转到 arg 指定的页面
+    HTTP_CODE serve_page(const char* arg, const route_params& params);
+
+    // 发送 url 实际请求的文件
+    HTTP_CODE serve_static(const char* arg, const route_params& params);
+
+    // 从文件缓存取出 url 对应的文件
+    HTTP_CODE serve_file(std::string_view url);
+
+    // 以 Prometheus 文本格式输出延迟直方图和计数器, 只响应本机的请求
+    HTTP_CODE serve_metrics(const char* arg, const route_params& params);
+
+    // 从请求体中取出用户名和密码, 格式有误时返回 false
+    bool parse_credentials(std::string_view& name, std::string_view& password);
+
     // get_line 用于将指针向后偏移, 指向未处理的字符
     // m_start_line 是已经解析的字符
     char* get_line() { return m_read_buf + m_start_line; };
@@ -123,7 +241,18 @@ private:
     // 返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
     LINE_STATUS parse_line();
 
-    void unmap();
+    // 释放正在发送的文件
+    void close_file();
+
+    // 从对象池取出读写缓冲区, 已持有时不重复分配
+    void alloc_buffers();
+
+    // 把读写缓冲区归还对象池
+    void free_buffers();
+
+    // 当前段已写满, 把尚未解析完的行(或请求体)移到新段开头继续接收
+    // 请求行、头部行超过一个池化段或请求体超过 MAX_CONTENT_LENGTH 时返回 false
+    bool grow_read_buf();
 
     /* 根据响应报文格式, 生成对应 8 个部分, 以下函数均由 do_request 调用 */
 
@@ -151,16 +280,21 @@ private:
     bool add_blank_line();
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
-    MYSQL*     mysql;
+    static std::atomic<int> m_user_count; // 多个反应堆线程同时增减
 
 private:
+    int         m_epollfd; // 连接所属的内核事件表
     int         m_sockfd;
     sockaddr_in m_address;
 
-    // 存储读取的请求报文数据
-    char m_read_buf[READ_BUFFER_SIZE];
+    // 存储读取的请求报文数据, 由若干段组成, 已解析的行留在之前的段中
+    chain_buffer m_read_chain;
+
+    // 读缓冲区的当前段, 以下下标都相对于当前段
+    char* m_read_buf;
+
+    // 当前段大小
+    int m_read_size;
 
     // 缓冲区中m_read_buf中数据的最后一个字节的下一个位置
     int m_read_idx;
@@ -171,8 +305,8 @@ private:
     // m_read_buf中已经解析的字符个数
     int m_start_line;
 
-    // 存储发出的响应报文数据
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    // 存储发出的响应报文数据, 大小为 WRITE_BUFFER_SIZE
+    char* m_write_buf;
 
     // 指示buffer中的长度
     int m_write_idx;
@@ -183,23 +317,36 @@ private:
     // 请求方法
     METHOD m_method;
 
-    // 以下为解析请求报文中对应的6个变量
-    char  m_real_file[FILENAME_LEN]; // 存储读取文件的名称
-    char* m_url;
-    char* m_version;
-    char* m_host;
-    int   m_content_length;
-    bool  m_linger;
-
-    char*       m_file_address; // 读取服务器上的文件地址
-    struct stat m_file_stat;
-
-    struct iovec m_iv[2]; // io向量机制iovec
-    int          m_iv_count;
-    int          cgi;             // 是否启用的  POST
-    char*        m_string;        // 存储请求头数据
-    int          bytes_to_send;   // 剩余发送字节数
-    int          bytes_have_send; // 已发送字节数
+    // 解析出的请求, 各字段指向读缓冲区
+    http_request m_request;
+
+    // 交给数据库线程的请求在数据库线程中的处理函数
+    typedef HTTP_CODE (http_conn::*db_handler)(MYSQL* mysql);
+    db_handler m_db_handler;
+
+    static db_worker<http_conn>* m_db_worker;
+    char         m_real_file[FILENAME_LEN]; // 存储读取文件的名称
+
+    std::shared_ptr<cached_file> m_file; // 请求的文件, 由文件缓存与连接共同持有
+
+    // 流水线响应队列, 按请求顺序发送
+    response m_responses[MAX_PIPELINE];
+    int      m_response_count; // 队列中的响应数
+    int      m_response_head;  // 正在发送的响应
+    off_t    m_response_sent;  // 正在发送的响应已发送的字节数
+    bool     m_pipelined;      // 缓冲区中还有待处理的请求
+
+    int   bytes_to_send;   // 剩余发送字节数
+    int   bytes_have_send; // 已发送字节数
+
+    int64_t m_accept_ns;  // 接受连接的时间, 发出第一个字节后清零
+    int64_t m_request_ns; // 开始读取当前请求的时间, 响应全部发出后清零
+    int64_t m_queued_ns;  // 放入线程池请求队列的时间
+
+    std::atomic<int> m_busy; // 连接交给处理线程的次数减去已交还的次数, 大于 0 时不能关闭
 };
 
+// 以 fd 为下标的连接表, http 对象在该 fd 第一次有连接时创建
+typedef lazy_table<http_conn> http_conn_table;
+
 #endif
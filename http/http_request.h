@@ -0,0 +1,82 @@
+/**
+ * @file http_request.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 解析后的请求报文
+ * 各字段都是指向读缓冲区的 string_view, 解析时不修改缓冲区, 也不申请内存;
+ * 读缓冲区换段时已解析的行留在原段中, 视图在请求处理完之前一直有效
+ * @version 0.1
+ * @date 2023-03-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef HTTP_REQUEST_H
+#define HTTP_REQUEST_H
+
+#include <strings.h>
+
+#include <string_view>
+
+// 请求头部的一个字段
+struct http_header {
+    std::string_view name;
+    std::string_view value;
+};
+
+struct http_request {
+    static const int MAX_HEADERS = 64; // 一个请求最多保存的头部字段数
+
+    http_request() { clear(); }
+
+    // 开始解析下一个请求
+    void clear() {
+        method = std::string_view();
+        url = std::string_view();
+        version = std::string_view();
+        host = std::string_view();
+        if_none_match = std::string_view();
+        body = std::string_view();
+        content_length = 0;
+        keep_alive = false;
+        header_count = 0;
+    }
+
+    // 保存一个头部字段, 超出 MAX_HEADERS 时返回 false
+    bool add_header(std::string_view name, std::string_view value) {
+        if (header_count >= MAX_HEADERS) {
+            return false;
+        }
+        headers[header_count].name = name;
+        headers[header_count].value = value;
+        ++header_count;
+        return true;
+    }
+
+    // 按名字查找字段, 不区分大小写, 不存在时返回空视图
+    std::string_view header(std::string_view name) const {
+        for (int i = 0; i < header_count; ++i) {
+            if (headers[i].name.size() == name.size() &&
+                strncasecmp(headers[i].name.data(), name.data(), name.size()) == 0) {
+                return headers[i].value;
+            }
+        }
+        return std::string_view();
+    }
+
+    std::string_view method;  // 请求方法
+    std::string_view url;     // 请求资源, 以 / 开头, 路由改写后可指向常量字符串
+    std::string_view version; // HTTP 版本
+    std::string_view body;    // 请求体
+
+    // 服务器用到的字段, 解析时顺带取出
+    std::string_view host;
+    std::string_view if_none_match;
+    long             content_length;
+    bool             keep_alive;
+
+    // 全部头部字段, 按出现顺序
+    http_header headers[MAX_HEADERS];
+    int         header_count;
+};
+
+#endif
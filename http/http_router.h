@@ -0,0 +1,205 @@
+/**
+ * @file http_router.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 路由表
+ * 按请求方法和路径把请求分派给处理函数, 启动时把注册的路由编成按字符的前缀树;
+ * 分派时沿路径逐字符下行, 耗时与路径长度成正比, 不申请内存
+ * 路由模式:
+ *   /log.html     精确匹配
+ *   /user/:id     参数, 匹配一个路径段, 取值由 route_params 返回
+ *   以 * 结尾     前缀, 如 /static/ 后接 *, 匹配以 /static/ 开头的路径, 剩余部分由 route_params::rest 返回
+ * 同一位置优先精确字符, 其次参数, 最后前缀
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 路由匹配时取出的参数
+struct route_params {
+    static const int MAX_PARAMS = 4; // 一条路由最多的参数个数
+
+    route_params() : count(0) {}
+
+    // 按名字取参数, 不存在时返回空视图
+    std::string_view get(std::string_view name) const {
+        for (int i = 0; i < count; ++i) {
+            if (names[i] == name) {
+                return values[i];
+            }
+        }
+        return std::string_view();
+    }
+
+    std::string_view names[MAX_PARAMS];
+    std::string_view values[MAX_PARAMS];
+    int              count;
+    std::string_view rest; // 前缀路由中 * 匹配的剩余路径
+};
+
+template <typename HANDLER>
+class http_router {
+public:
+    static const int MAX_METHODS = 16; // 请求方法取值的上限
+
+    // 一条路由: 处理函数及注册时给定的参数, 如跳转页面的路径
+    struct route {
+        route() : handler(NULL), arg(NULL) {}
+        HANDLER     handler;
+        const char* arg;
+    };
+
+    http_router() { m_nodes.push_back(node()); }
+
+    // 注册路由, 只在启动时调用
+    // 模式有误、参数过多或与已有路由重复时返回 false
+    bool add(int method, const char* pattern, HANDLER handler, const char* arg = NULL) {
+        if (method < 0 || method >= MAX_METHODS || !handler || pattern[0] != '/') {
+            return false;
+        }
+        int n = 0;
+        int params = 0;
+        for (const char* p = pattern; *p; ++p) {
+            // 参数只能占据整个路径段
+            if (*p == ':' && p[-1] == '/') {
+                const char* end = strchr(p, '/');
+                if (!end) {
+                    end = p + strlen(p);
+                }
+                std::string name(p + 1, end - p - 1);
+                if (name.empty() || ++params > route_params::MAX_PARAMS) {
+                    return false;
+                }
+                if (m_nodes[n].param_child == -1) {
+                    int child = new_node();
+                    m_nodes[n].param_child = child;
+                    m_nodes[n].param_name = name;
+                }
+                // 同一位置的参数名必须一致
+                else if (m_nodes[n].param_name != name) {
+                    return false;
+                }
+                n = m_nodes[n].param_child;
+                p = end - 1;
+            }
+            // 前缀只能出现在末尾
+            else if (*p == '*') {
+                if (p[1] != '\0' || m_nodes[n].prefix[method].handler) {
+                    return false;
+                }
+                set_route(m_nodes[n].prefix[method], handler, arg);
+                return true;
+            }
+            else {
+                n = child(n, *p);
+            }
+        }
+        if (m_nodes[n].exact[method].handler) {
+            return false;
+        }
+        set_route(m_nodes[n].exact[method], handler, arg);
+        return true;
+    }
+
+    // 按方法和路径查找路由, 没有匹配时返回 NULL
+    const route* match(int method, std::string_view path, route_params& params) const {
+        params.count = 0;
+        params.rest = std::string_view();
+        if (method < 0 || method >= MAX_METHODS) {
+            return NULL;
+        }
+        return match_from(0, path.data(), path.data() + path.size(), method, params);
+    }
+
+private:
+    // 前缀树节点, 子节点按字符存放, 每个节点的分支很少, 顺序查找即可
+    struct node {
+        node() : param_child(-1) {}
+        std::vector<std::pair<char, int> > children;
+        int                                param_child; // 参数子节点
+        std::string                        param_name;
+        route                              exact[MAX_METHODS];  // 路径在此结束的路由
+        route                              prefix[MAX_METHODS]; // 以此为前缀的路由
+    };
+
+    int new_node() {
+        m_nodes.push_back(node());
+        return m_nodes.size() - 1;
+    }
+
+    // 取字符 c 对应的子节点, 不存在时创建
+    int child(int n, char c) {
+        for (size_t i = 0; i < m_nodes[n].children.size(); ++i) {
+            if (m_nodes[n].children[i].first == c) {
+                return m_nodes[n].children[i].second;
+            }
+        }
+        int next = new_node();
+        m_nodes[n].children.push_back(std::make_pair(c, next));
+        return next;
+    }
+
+    static void set_route(route& r, HANDLER handler, const char* arg) {
+        r.handler = handler;
+        r.arg = arg;
+    }
+
+    const route* match_from(
+        int n, const char* p, const char* end, int method, route_params& params) const {
+        const node& cur = m_nodes[n];
+        if (p == end) {
+            if (cur.exact[method].handler) {
+                return &cur.exact[method];
+            }
+        }
+        else {
+            // 精确字符
+            for (size_t i = 0; i < cur.children.size(); ++i) {
+                if (cur.children[i].first == *p) {
+                    const route* r = match_from(cur.children[i].second, p + 1, end, method, params);
+                    if (r) {
+                        return r;
+                    }
+                    break;
+                }
+            }
+
+            // 参数, 匹配到下一个 / 为止
+            if (cur.param_child != -1 && *p != '/') {
+                const char* seg_end = p;
+                while (seg_end < end && *seg_end != '/') {
+                    ++seg_end;
+                }
+                int i = params.count++;
+                params.names[i] = cur.param_name;
+                params.values[i] = std::string_view(p, seg_end - p);
+                const route* r = match_from(cur.param_child, seg_end, end, method, params);
+                if (r) {
+                    return r;
+                }
+                --params.count;
+            }
+        }
+
+        // 前缀
+        if (cur.prefix[method].handler) {
+            params.rest = std::string_view(p, end - p);
+            return &cur.prefix[method];
+        }
+        return NULL;
+    }
+
+private:
+    std::vector<node> m_nodes; // 节点 0 为根, 启动后不再修改
+};
+
+#endif
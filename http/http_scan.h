@@ -0,0 +1,105 @@
+/**
+ * @file http_scan.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 请求报文扫描
+ * 查找行尾、分隔符时一次比较 16(SSE2) 或 32(AVX2) 字节, 不支持的平台逐字节比较;
+ * 头部字段名先按长度分派, 每个字段最多做一次不区分大小写的比较
+ * @version 0.1
+ * @date 2023-03-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <strings.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 在 [p, end) 中查找第一个等于 a 或 b 的字节, 没有时返回 end
+// 只读取 [p, end) 内的字节
+inline const char* scan_any(const char* p, const char* end, char a, char b) {
+#if defined(__AVX2__)
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        int     mask = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    const __m128i wa = _mm_set1_epi8(a);
+    const __m128i wb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int     mask =
+            _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, wa), _mm_cmpeq_epi8(v, wb)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    // 不足一个向量的剩余字节逐个比较
+    for (; p < end; ++p) {
+        if (*p == a || *p == b) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// 查找行尾, 即第一个 \r 或 \n
+inline const char* scan_line_end(const char* p, const char* end) {
+    return scan_any(p, end, '\r', '\n');
+}
+
+// 查找请求行中的分隔符, 即第一个空格或 \t
+inline const char* scan_blank(const char* p, const char* end) {
+    return scan_any(p, end, ' ', '\t');
+}
+
+// 跳过空格和 \t
+inline const char* skip_blank(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    return p;
+}
+
+// 服务器处理的头部字段
+enum HTTP_HEADER {
+    HEADER_UNKNOWN = 0,
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_IF_NONE_MATCH,
+    HEADER_CONTENT_LENGTH
+};
+
+// 按字段名长度分派, 同一长度只有一个候选字段, 不再逐个 strncasecmp
+inline HTTP_HEADER lookup_header(const char* name, int len) {
+    switch (len) {
+        case 4:
+            return strncasecmp(name, "Host", 4) == 0 ? HEADER_HOST : HEADER_UNKNOWN;
+        case 10:
+            return strncasecmp(name, "Connection", 10) == 0 ? HEADER_CONNECTION : HEADER_UNKNOWN;
+        case 13:
+            return strncasecmp(name, "If-None-Match", 13) == 0 ? HEADER_IF_NONE_MATCH
+                                                                : HEADER_UNKNOWN;
+        case 14:
+            return strncasecmp(name, "Content-Length", 14) == 0 ? HEADER_CONTENT_LENGTH
+                                                                 : HEADER_UNKNOWN;
+        default:
+            return HEADER_UNKNOWN;
+    }
+}
+
+#endif
@@ -76,6 +76,32 @@ private:
     pthread_mutex_t m_mutex; // 互斥锁
 };
 
+// 读写锁
+class rwlocker {
+public:
+    // 构造函数, 初始化读写锁
+    rwlocker() {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0) {
+            throw std::exception();
+        }
+    }
+
+    // 析构函数, 释放读写锁资源
+    ~rwlocker() { pthread_rwlock_destroy(&m_rwlock); }
+
+    // 加读锁, 多个线程可同时持有
+    bool rdlock() { return pthread_rwlock_rdlock(&m_rwlock) == 0; }
+
+    // 加写锁
+    bool wrlock() { return pthread_rwlock_wrlock(&m_rwlock) == 0; }
+
+    // 解锁
+    bool unlock() { return pthread_rwlock_unlock(&m_rwlock) == 0; }
+
+private:
+    pthread_rwlock_t m_rwlock; // 读写锁
+};
+
 // 条件变量
 class cond {
 public:
@@ -0,0 +1,413 @@
+/**
+ * @file binlog.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 二进制日志实现
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "binlog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "binlog_format.h"
+
+static thread_local char* t_rec = NULL;  // 当前线程编码记录的缓冲区
+static thread_local char* t_text = NULL; // 不支持的格式串先格式化到这里
+
+// 追加 len 字节, 返回新的长度
+static int put(char* buf, int n, const void* p, size_t len) {
+    memcpy(buf + n, p, len);
+    return n + len;
+}
+
+// 补齐 8 字节并填写记录头, 返回记录长度
+static int finish(char* buf, int n, int fmt, int level) {
+    int len = binlog_align(n);
+    memset(buf + n, '\0', len - n);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    binlog_record r;
+    r.len = len;
+    r.fmt = fmt;
+    r.level = level;
+    r.reserved = 0;
+    r.ts = (int64_t)now.tv_sec * 1000000000L + now.tv_nsec;
+    memcpy(buf, &r, sizeof(r));
+    return len;
+}
+
+binlog::binlog() {
+    m_file_size = 0;
+    m_record_size = 0;
+    m_seq = 0;
+    m_seg.store(NULL);
+    m_text.id = 0;
+    m_formats.push_back(NULL); // 编号 0 表示格式串定义
+}
+
+binlog::~binlog() {
+    close();
+    for (size_t i = 0; i < m_retired.size(); ++i) {
+        delete m_retired[i];
+    }
+    for (size_t i = 1; i < m_formats.size(); ++i) {
+        delete m_formats[i];
+    }
+}
+
+bool binlog::init(const char* file_name, size_t file_size, int record_size) {
+    // "./a/b/c" -> "./a/b/", "c"
+    const char* p = strrchr(file_name, '/');
+    if (p == NULL) {
+        m_log_name = file_name;
+    }
+    else {
+        m_dir_name.assign(file_name, p - file_name + 1);
+        m_log_name = p + 1;
+    }
+    m_file_size = std::max(file_size, (size_t)MIN_FILE_SIZE);
+    m_record_size = std::max(record_size, 64);
+
+    // 编号 1 固定为 "%s", 用于按文本记录的日志
+    format_info* text = new format_info;
+    text->id = 1;
+    text->text = "%s";
+    text->types = "s";
+    m_formats.push_back(text);
+
+    m_mutex.lock();
+    rotate_locked();
+    bool ok = m_seg.load() != NULL;
+    m_mutex.unlock();
+    return ok;
+}
+
+void binlog::write(int level, const char* format, va_list valst) {
+    if (!t_rec) {
+        t_rec = new char[m_record_size];
+    }
+
+    const format_info* f = lookup(format);
+    int                len = 0;
+    if (f->id) {
+        va_list args;
+        va_copy(args, valst);
+        len = encode(t_rec, level, f, args);
+        va_end(args);
+    }
+
+    // 不支持的格式串或超长的记录格式化为文本, 超长的截断
+    if (len == 0) {
+        if (!t_text) {
+            t_text = new char[m_record_size];
+        }
+        int max = m_record_size - sizeof(binlog_record) - sizeof(uint32_t) - 8;
+        int n = vsnprintf(t_text, max, format, valst);
+        len = encode_text(t_rec, level, t_text, std::min(std::max(n, 0), max - 1));
+    }
+    append(t_rec, len);
+}
+
+const binlog::format_info* binlog::lookup(const char* format) {
+    // 每个线程缓存已查到的格式串, 命中时不加锁
+    static thread_local std::unordered_map<const char*, const format_info*> t_formats;
+    std::unordered_map<const char*, const format_info*>::iterator it = t_formats.find(format);
+    if (it != t_formats.end()) {
+        return it->second;
+    }
+
+    m_mutex.lock();
+    format_info*& f = m_by_addr[format];
+    if (f == NULL) {
+        std::string      types;
+        std::vector<int> precs;
+        if ((int)m_formats.size() > MAX_FORMATS || !binlog_arg_types(format, types, precs)) {
+            f = &m_text;
+        }
+        else {
+            f = new format_info;
+            f->id = m_formats.size();
+            f->text = format;
+            f->types = types;
+            f->precs = precs;
+            m_formats.push_back(f);
+
+            // 定义在持有锁时写入, 使用该格式串的记录都在定义之后
+            std::string def;
+            encode_format(def, f);
+            append_locked(def.data(), def.size());
+        }
+    }
+    const format_info* found = f;
+    m_mutex.unlock();
+
+    t_formats[format] = found;
+    return found;
+}
+
+int binlog::encode(char* buf, int level, const format_info* f, va_list valst) {
+    int n = sizeof(binlog_record);
+    int max = m_record_size - 8; // 留出对齐的空间
+    int last_int = -1;           // 最近一个 int 参数, '*' 给出的精度
+    int prec_index = 0;
+
+    for (size_t i = 0; i < f->types.size(); ++i) {
+        switch (f->types[i]) {
+            case ARG_INT: {
+                int v = va_arg(valst, int);
+                if (n + (int)sizeof(v) > max) {
+                    return 0;
+                }
+                n = put(buf, n, &v, sizeof(v));
+                last_int = v;
+                break;
+            }
+            case ARG_LONG: {
+                long long v = va_arg(valst, long long);
+                if (n + (int)sizeof(v) > max) {
+                    return 0;
+                }
+                n = put(buf, n, &v, sizeof(v));
+                break;
+            }
+            case ARG_DOUBLE: {
+                double v = va_arg(valst, double);
+                if (n + (int)sizeof(v) > max) {
+                    return 0;
+                }
+                n = put(buf, n, &v, sizeof(v));
+                break;
+            }
+            case ARG_LDOUBLE: {
+                long double v = va_arg(valst, long double);
+                if (n + (int)sizeof(v) > max) {
+                    return 0;
+                }
+                n = put(buf, n, &v, sizeof(v));
+                break;
+            }
+            case ARG_PTR: {
+                uint64_t v = (uint64_t)(uintptr_t)va_arg(valst, void*);
+                if (n + (int)sizeof(v) > max) {
+                    return 0;
+                }
+                n = put(buf, n, &v, sizeof(v));
+                break;
+            }
+            case ARG_STR: {
+                // 超长的字符串截断
+                const char* s = va_arg(valst, const char*);
+                if (s == NULL) {
+                    s = "(null)";
+                }
+                int room = max - n - (int)sizeof(uint32_t);
+                if (room < 0) {
+                    return 0;
+                }
+                uint32_t slen = strnlen(s, room);
+                n = put(buf, n, &slen, sizeof(slen));
+                n = put(buf, n, s, slen);
+                break;
+            }
+            case ARG_STR_PREC: {
+                // 与 printf 相同最多读精度个字节, 字符串可以不以 \0 结尾; 负的精度等于没有精度
+                const char* s = va_arg(valst, const char*);
+                int         prec = f->precs[prec_index++];
+                if (prec < 0) {
+                    prec = last_int;
+                }
+                if (s == NULL) {
+                    s = "(null)";
+                }
+                int room = max - n - (int)sizeof(uint32_t);
+                if (room < 0) {
+                    return 0;
+                }
+                uint32_t slen = strnlen(s, prec >= 0 ? std::min(prec, room) : room);
+                n = put(buf, n, &slen, sizeof(slen));
+                n = put(buf, n, s, slen);
+                break;
+            }
+        }
+    }
+    return finish(buf, n, f->id, level);
+}
+
+int binlog::encode_text(char* buf, int level, const char* text, int len) {
+    int      n = sizeof(binlog_record);
+    uint32_t slen = len;
+    n = put(buf, n, &slen, sizeof(slen));
+    n = put(buf, n, text, slen);
+    return finish(buf, n, 1, level);
+}
+
+void binlog::encode_format(std::string& buf, const format_info* f) {
+    binlog_record r;
+    uint32_t      id = f->id;
+    uint32_t      n = sizeof(r) + sizeof(id) + f->text.size() + 1;
+    r.len = binlog_align(n);
+    r.fmt = 0;
+    r.level = 0;
+    r.reserved = 0;
+    r.ts = 0;
+    buf.append((const char*)&r, sizeof(r));
+    buf.append((const char*)&id, sizeof(id));
+    buf.append(f->text.c_str(), f->text.size() + 1);
+    buf.append(r.len - n, '\0');
+}
+
+void binlog::append(const char* rec, int len) {
+    while (1) {
+        segment* seg = m_seg.load();
+        if (seg == NULL) {
+            return;
+        }
+
+        // 先登记再确认仍是当前文件, 换文件的线程看不到登记时, 这里一定能看到新文件
+        seg->writers.fetch_add(1);
+        if (m_seg.load() != seg) {
+            seg->writers.fetch_sub(1);
+            continue;
+        }
+
+        size_t off = seg->used.fetch_add(len, std::memory_order_relaxed);
+        if (off + len <= seg->size) {
+            memcpy(seg->base + off, rec, len);
+            seg->writers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        seg->writers.fetch_sub(1, std::memory_order_release);
+
+        // 文件已满, 只有第一个发现的线程换文件
+        m_mutex.lock();
+        if (m_seg.load() == seg) {
+            rotate_locked();
+        }
+        m_mutex.unlock();
+    }
+}
+
+void binlog::append_locked(const char* rec, int len) {
+    segment* seg = m_seg.load();
+    if (seg == NULL) {
+        return;
+    }
+
+    // 持有锁时当前文件不会被换掉
+    seg->writers.fetch_add(1);
+    size_t off = seg->used.fetch_add(len, std::memory_order_relaxed);
+    bool   fits = off + len <= seg->size;
+    if (fits) {
+        memcpy(seg->base + off, rec, len);
+    }
+    seg->writers.fetch_sub(1, std::memory_order_release);
+
+    // 新文件开头会写入包括这条在内的全部定义
+    if (!fits) {
+        rotate_locked();
+    }
+}
+
+binlog::segment* binlog::open_segment() {
+    time_t    t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    // 跳过已存在的文件, 重启后不覆盖
+    char name[512];
+    int  fd = -1;
+    while (fd < 0) {
+        snprintf(
+            name, sizeof(name), "%s%d_%02d_%02d_%s.%d.blog", m_dir_name.c_str(),
+            my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, m_log_name.c_str(), m_seq++);
+        fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno != EEXIST) {
+            return NULL;
+        }
+    }
+
+    if (ftruncate(fd, m_file_size) != 0) {
+        ::close(fd);
+        unlink(name);
+        return NULL;
+    }
+    void* base = mmap(NULL, m_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        unlink(name);
+        return NULL;
+    }
+
+    segment* seg = new segment;
+    seg->fd = fd;
+    seg->base = (char*)base;
+    seg->size = m_file_size;
+    seg->writers.store(0);
+
+    binlog_file_header h;
+    memcpy(h.magic, BINLOG_MAGIC, sizeof(h.magic));
+    h.gmtoff = my_tm.tm_gmtoff;
+    memcpy(seg->base, &h, sizeof(h));
+    size_t used = sizeof(h);
+
+    // 每个文件都能单独解码
+    std::string defs;
+    for (size_t i = 1; i < m_formats.size(); ++i) {
+        encode_format(defs, m_formats[i]);
+    }
+    size_t n = std::min(defs.size(), seg->size - used);
+    memcpy(seg->base + used, defs.data(), n);
+    seg->used.store(used + n);
+    return seg;
+}
+
+void binlog::rotate_locked() {
+    segment* old = m_seg.load();
+    segment* next = open_segment();
+    if (next == NULL) {
+        fprintf(stderr, "binlog: cannot create log file, binary logging stopped\n");
+    }
+    m_seg.store(next);
+    if (old) {
+        retire(old);
+    }
+}
+
+void binlog::retire(segment* seg) {
+    // 换文件后新登记的线程会退回, 只需等已登记的写完
+    while (seg->writers.load() != 0) {
+        sched_yield();
+    }
+
+    // 截掉未用的部分, 文件满时末尾预留失败的空间为 0, 解码到长度为 0 的记录结束
+    size_t end = std::min(seg->used.load(), seg->size);
+    munmap(seg->base, seg->size);
+    if (ftruncate(seg->fd, end) != 0) {
+        perror("binlog: ftruncate");
+    }
+    ::close(seg->fd);
+    m_retired.push_back(seg);
+}
+
+void binlog::close() {
+    m_mutex.lock();
+    segment* seg = m_seg.exchange(NULL);
+    if (seg) {
+        retire(seg);
+    }
+    m_mutex.unlock();
+}
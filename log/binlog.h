@@ -0,0 +1,107 @@
+/**
+ * @file binlog.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 二进制日志
+ * 不格式化日志, 只记录格式串编号、时间戳和原始参数, 由 binlog_decode 离线转为文本;
+ * 日志文件用 mmap 映射, 各线程原子地预留空间后直接写入, 写满后换新文件;
+ * 格式串按地址区分, 须为字符串字面量, 首次使用时分配编号并写入定义, 每个文件开头重写全部定义
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../lock/locker.h"
+
+class binlog {
+public:
+    static const size_t MIN_FILE_SIZE = 1 << 20; // 日志文件的最小字节数
+    static const int    MAX_FORMATS = 65535;     // 格式串编号上限, 超出的按文本记录
+
+    binlog();
+    ~binlog();
+
+    // 打开第一个日志文件
+    // file_name 同文本日志, 实际文件名为 目录/年_月_日_文件名.序号.blog
+    // file_size 为每个文件的字节数, record_size 为单条记录的最大字节数, 超长的字符串截断
+    bool init(const char* file_name, size_t file_size, int record_size);
+
+    // 写一条日志
+    void write(int level, const char* format, va_list valst);
+
+    // 关闭当前文件, 之后的日志丢弃
+    void close();
+
+private:
+    // 已分配编号的格式串
+    struct format_info {
+        int              id;    // 编号, 0 表示不支持的格式串, 按文本记录
+        std::string      text;  // 格式串
+        std::string      types; // 参数类型
+        std::vector<int> precs; // 各 ARG_STR_PREC 的精度, -1 表示由前一个参数给出
+    };
+
+    // 一个映射到内存的日志文件
+    struct segment {
+        int                 fd;
+        char*               base;
+        size_t              size;
+        std::atomic<size_t> used;    // 已预留的字节数, 可能超过 size
+        std::atomic<int>    writers; // 正在写入的线程数
+    };
+
+    // 取得格式串的编号, 首次使用时分配并写入定义
+    const format_info* lookup(const char* format);
+
+    // 按参数类型编码一条记录, 返回长度; 超出 record_size 时返回 0
+    int encode(char* buf, int level, const format_info* f, va_list valst);
+
+    // 把已格式化的文本编码为 "%s" 的记录
+    int encode_text(char* buf, int level, const char* text, int len);
+
+    // 预留空间写入记录, 文件已满时换新文件
+    void append(const char* rec, int len);
+
+    // 持有 m_mutex 时写入格式串定义
+    void append_locked(const char* rec, int len);
+
+    // 编码格式串定义, 追加到 buf
+    static void encode_format(std::string& buf, const format_info* f);
+
+    // 创建新文件并写入全部格式串定义, 失败返回 NULL; 调用方持有 m_mutex
+    segment* open_segment();
+
+    // 换到新文件, 创建失败时之后的日志丢弃; 调用方持有 m_mutex
+    void rotate_locked();
+
+    // 等正在写入的线程写完后截断并关闭文件
+    void retire(segment* seg);
+
+private:
+    std::string m_dir_name;    // 路径名
+    std::string m_log_name;    // 日志文件名
+    size_t      m_file_size;   // 每个文件的字节数
+    int         m_record_size; // 单条记录的最大字节数
+    int         m_seq;         // 下一个文件的序号
+
+    std::atomic<segment*> m_seg;     // 当前文件, 关闭后为 NULL
+    std::vector<segment*> m_retired; // 已关闭的文件, 其他线程可能仍在访问计数, 析构时释放
+    locker                m_mutex;   // 保护格式串表和换文件
+
+    std::unordered_map<const char*, format_info*> m_by_addr; // 按地址查找格式串
+    std::vector<format_info*>                      m_formats; // 下标为编号
+    format_info                                    m_text;    // 不支持的格式串共用
+};
+
+#endif
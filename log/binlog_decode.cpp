@@ -0,0 +1,275 @@
+/**
+ * @file binlog_decode.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 把二进制日志转为与文本日志相同格式的文本, 输出到标准输出
+ * 用法: ./binlog_decode 2023_03_31_ServerLog.0.blog [更多文件...]
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "binlog_format.h"
+
+// 按转换说明格式化一个参数, 追加到 out
+template <typename T>
+static void append_arg(std::string& out, const std::string& spec, T v) {
+    char buf[256];
+    int  n = snprintf(buf, sizeof(buf), spec.c_str(), v);
+    if (n < 0) {
+        return;
+    }
+    if (n < (int)sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::string big(n + 1, '\0');
+    snprintf(&big[0], n + 1, spec.c_str(), v);
+    out.append(big.data(), n);
+}
+
+// 从记录内容中取出 len 字节, 不足时返回 false
+static bool take(const char*& p, const char* end, void* v, size_t len) {
+    if ((size_t)(end - p) < len) {
+        return false;
+    }
+    memcpy(v, p, len);
+    p += len;
+    return true;
+}
+
+// 按格式串展开一条记录的参数
+static void expand(const std::string& format, const char* p, const char* end, std::string& out) {
+    const char* f = format.c_str();
+    while (*f) {
+        const char* q = strchr(f, '%');
+        if (q == NULL) {
+            out.append(f);
+            return;
+        }
+        out.append(f, q - f);
+
+        binlog_spec s;
+        if (!binlog_parse_spec(q, s)) {
+            out.append(q);
+            return;
+        }
+        f = s.end;
+        if (s.conv == '%') {
+            out.push_back('%');
+            continue;
+        }
+
+        // 重建转换说明, '*' 换成记录中的值, 长度修饰符按记录中的类型重写
+        std::string spec("%");
+        spec.append(s.flags, s.flags_len);
+        if (s.star_width) {
+            int w;
+            if (!take(p, end, &w, sizeof(w))) {
+                out.append("<?>");
+                return;
+            }
+            spec += std::to_string(w);
+        }
+        else {
+            spec.append(s.width, s.width_len);
+        }
+        if (s.has_prec) {
+            if (s.star_prec) {
+                int prec;
+                if (!take(p, end, &prec, sizeof(prec))) {
+                    out.append("<?>");
+                    return;
+                }
+                // 负的精度等于没有精度
+                if (prec >= 0) {
+                    spec += "." + std::to_string(prec);
+                }
+            }
+            else {
+                spec.push_back('.');
+                spec.append(s.prec, s.prec_len);
+            }
+        }
+
+        bool ok = true;
+        switch (s.type) {
+            case ARG_INT: {
+                int v;
+                spec.append(s.length, s.length_len);
+                spec.push_back(s.conv);
+                if ((ok = take(p, end, &v, sizeof(v)))) {
+                    append_arg(out, spec, v);
+                }
+                break;
+            }
+            case ARG_LONG: {
+                long long v;
+                spec.append("ll");
+                spec.push_back(s.conv);
+                if ((ok = take(p, end, &v, sizeof(v)))) {
+                    append_arg(out, spec, v);
+                }
+                break;
+            }
+            case ARG_DOUBLE: {
+                double v;
+                spec.push_back(s.conv);
+                if ((ok = take(p, end, &v, sizeof(v)))) {
+                    append_arg(out, spec, v);
+                }
+                break;
+            }
+            case ARG_LDOUBLE: {
+                long double v;
+                spec.push_back('L');
+                spec.push_back(s.conv);
+                if ((ok = take(p, end, &v, sizeof(v)))) {
+                    append_arg(out, spec, v);
+                }
+                break;
+            }
+            case ARG_PTR: {
+                uint64_t v;
+                spec.push_back('p');
+                if ((ok = take(p, end, &v, sizeof(v)))) {
+                    append_arg(out, spec, (void*)(uintptr_t)v);
+                }
+                break;
+            }
+            case ARG_STR: {
+                uint32_t len;
+                spec.push_back('s');
+                if ((ok = take(p, end, &len, sizeof(len)) && (size_t)(end - p) >= len)) {
+                    append_arg(out, spec, std::string(p, len).c_str());
+                    p += len;
+                }
+                break;
+            }
+        }
+        if (!ok) {
+            out.append("<?>");
+            return;
+        }
+    }
+}
+
+// 与文本日志相同的行首
+// eg. 2023-03-07 13:22:45.134070 [info]:
+static void append_prefix(std::string& out, int64_t ts, int64_t gmtoff, int level) {
+    static const char* levels[] = {"[debug]: ", "[info]: ", "[warn]: ", "[erro]: "};
+
+    time_t    sec = ts / 1000000000L + gmtoff;
+    struct tm my_tm;
+    gmtime_r(&sec, &my_tm);
+
+    char buf[64];
+    int  n = snprintf(
+        buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%06ld %s", my_tm.tm_year + 1900,
+        my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec,
+        (long)(ts % 1000000000L / 1000), level >= 0 && level <= 3 ? levels[level] : levels[1]);
+    out.append(buf, n);
+}
+
+static bool decode(const char* name) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        perror(name);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(binlog_file_header)) {
+        fprintf(stderr, "%s: not a binary log\n", name);
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    char*  base = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(name);
+        return false;
+    }
+
+    binlog_file_header h;
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, BINLOG_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "%s: not a binary log\n", name);
+        munmap(base, size);
+        return false;
+    }
+
+    std::vector<std::string> formats;
+    std::string              line;
+    size_t                   pos = sizeof(h);
+    bool                     ok = true;
+    while (pos + sizeof(binlog_record) <= size) {
+        binlog_record r;
+        memcpy(&r, base + pos, sizeof(r));
+
+        // 长度为 0 是未写入的部分
+        if (r.len == 0) {
+            break;
+        }
+        if (r.len < sizeof(r) || r.len > size - pos) {
+            fprintf(stderr, "%s: bad record at offset %zu\n", name, pos);
+            ok = false;
+            break;
+        }
+        const char* p = base + pos + sizeof(r);
+        const char* end = base + pos + r.len;
+        pos += r.len;
+
+        // 格式串定义
+        if (r.fmt == 0) {
+            uint32_t id;
+            if (take(p, end, &id, sizeof(id))) {
+                if (id >= formats.size()) {
+                    formats.resize(id + 1);
+                }
+                formats[id].assign(p, strnlen(p, end - p));
+            }
+            continue;
+        }
+
+        line.clear();
+        append_prefix(line, r.ts, h.gmtoff, r.level);
+        if (r.fmt < formats.size()) {
+            expand(formats[r.fmt], p, end, line);
+        }
+        else {
+            line.append("<unknown format ").append(std::to_string(r.fmt)).append(">");
+        }
+        line.push_back('\n');
+        fwrite(line.data(), 1, line.size(), stdout);
+    }
+
+    munmap(base, size);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc <= 1) {
+        printf("usage: %s file.blog [file.blog ...]\n", argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!decode(argv[i])) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
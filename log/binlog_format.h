@@ -0,0 +1,186 @@
+/**
+ * @file binlog_format.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 二进制日志的文件格式和 printf 格式串解析, 由写日志的一方和 binlog_decode 共用
+ * 文件以 binlog_file_header 开头, 之后是按 8 字节对齐的记录; 长度为 0 的记录表示数据结束
+ * 格式串编号为 0 的记录是格式串定义, 内容为 4 字节的编号和以 \0 结尾的格式串;
+ * 其余记录的内容为按格式串顺序排列的原始参数, 整数 4 或 8 字节, 浮点数 8 或 16 字节,
+ * 字符串为 4 字节长度加内容, 指针 8 字节
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef BINLOG_FORMAT_H
+#define BINLOG_FORMAT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+static const char BINLOG_MAGIC[8] = {'T', 'W', 'S', 'B', 'L', 'O', 'G', '1'};
+
+// 文件头
+struct binlog_file_header {
+    char    magic[8];
+    int64_t gmtoff; // 写日志时所在时区与 UTC 相差的秒数, 解码时按该时区输出
+};
+
+// 记录头
+struct binlog_record {
+    uint32_t len;      // 记录长度, 包括记录头和对齐的填充
+    uint16_t fmt;      // 格式串编号, 0 表示格式串定义
+    uint8_t  level;    // 日志级别
+    uint8_t  reserved;
+    int64_t  ts;       // 时间戳, 纳秒
+};
+
+// 参数类型
+enum BINLOG_ARG {
+    ARG_INT = 'i',      // int, 4 字节
+    ARG_LONG = 'l',     // long、long long、size_t 等, 8 字节
+    ARG_DOUBLE = 'd',   // double, 8 字节
+    ARG_LDOUBLE = 'D',  // long double
+    ARG_STR = 's',      // const char*, 4 字节长度加内容
+    ARG_STR_PREC = 'S', // 带精度的 const char*, 最多取精度个字节, 记录格式与 ARG_STR 相同
+    ARG_PTR = 'p'       // void*, 8 字节
+};
+
+// 一个转换说明, 各字段指向格式串中的对应部分
+struct binlog_spec {
+    const char* begin;    // '%' 的位置
+    const char* end;      // 转换字符之后
+    const char* flags;    // 标志
+    int         flags_len;
+    const char* width;    // 宽度数字, star_width 时不用
+    int         width_len;
+    const char* prec;     // 精度数字, 不含 '.', star_prec 时不用
+    int         prec_len;
+    const char* length;   // 长度修饰符
+    int         length_len;
+    bool        star_width; // 宽度由参数给出
+    bool        has_prec;   // 是否有精度
+    bool        star_prec;  // 精度由参数给出
+    char        conv;       // 转换字符, %% 为 '%'
+    char        type;       // 参数类型, 0 表示不取参数
+};
+
+// 解析 p 处('%')的转换说明, 不支持的转换(%n、%lc、%ls 等)返回 false
+inline bool binlog_parse_spec(const char* p, binlog_spec& s) {
+    memset(&s, '\0', sizeof(s));
+    s.begin = p++;
+
+    s.flags = p;
+    while (*p && strchr("-+ #0'", *p)) {
+        ++p;
+    }
+    s.flags_len = p - s.flags;
+
+    s.width = p;
+    if (*p == '*') {
+        s.star_width = true;
+        ++p;
+    }
+    while (*p >= '0' && *p <= '9') {
+        ++p;
+    }
+    s.width_len = s.star_width ? 0 : p - s.width;
+
+    if (*p == '.') {
+        s.has_prec = true;
+        s.prec = ++p;
+        if (*p == '*') {
+            s.star_prec = true;
+            ++p;
+        }
+        while (*p >= '0' && *p <= '9') {
+            ++p;
+        }
+        s.prec_len = s.star_prec ? 0 : p - s.prec;
+    }
+
+    s.length = p;
+    while (*p && strchr("hlLqjzZt", *p)) {
+        ++p;
+    }
+    s.length_len = p - s.length;
+    bool wide = s.length_len > 0 && *s.length != 'h' && *s.length != 'L';
+
+    s.conv = *p;
+    if (!*p) {
+        return false;
+    }
+    s.end = p + 1;
+
+    switch (s.conv) {
+        case '%':
+            s.type = 0;
+            return true;
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            s.type = wide ? ARG_LONG : ARG_INT;
+            return true;
+        case 'c':
+            s.type = ARG_INT;
+            return !wide;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            s.type = (s.length_len > 0 && *s.length == 'L') ? ARG_LDOUBLE : ARG_DOUBLE;
+            return true;
+        case 's':
+            s.type = ARG_STR;
+            return s.length_len == 0;
+        case 'p':
+            s.type = ARG_PTR;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 按顺序列出格式串需要的参数类型, 包括 '*' 给出的宽度和精度; 有不支持的转换时返回 false
+// 带精度的 %s 列为 ARG_STR_PREC, 字符串不必以 \0 结尾, 精度按顺序放入 precs, '*' 给出的记为 -1
+inline bool binlog_arg_types(const char* format, std::string& types, std::vector<int>& precs) {
+    types.clear();
+    precs.clear();
+    for (const char* p = strchr(format, '%'); p; p = strchr(p, '%')) {
+        binlog_spec s;
+        if (!binlog_parse_spec(p, s)) {
+            return false;
+        }
+        if (s.star_width) {
+            types.push_back(ARG_INT);
+        }
+        if (s.star_prec) {
+            types.push_back(ARG_INT);
+        }
+        if (s.type == ARG_STR && s.has_prec) {
+            types.push_back(ARG_STR_PREC);
+            precs.push_back(s.star_prec ? -1 : atoi(std::string(s.prec, s.prec_len).c_str()));
+        }
+        else if (s.type) {
+            types.push_back(s.type);
+        }
+        p = s.end;
+    }
+    return true;
+}
+
+// 记录长度按 8 字节对齐
+inline uint32_t binlog_align(uint32_t len) { return (len + 7) & ~7u; }
+
+#endif
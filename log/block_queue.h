@@ -3,6 +3,8 @@
  * @author Chang Chiang (Chang_Chiang@outlook.com.com)
  * @brief 循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;
  * 线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
+ * 元素以交换的方式移入移出, string 等元素的缓冲区在生产者、队列和消费者之间循环使用;
+ * 只在有消费者等待时唤醒, 每个元素最多唤醒一个; 支持批量存取
  * @version 0.1
  * @date 2023-03-12
  *
@@ -17,7 +19,9 @@
 #include <stdlib.h>
 #include <sys/time.h>
 
+#include <algorithm>
 #include <iostream>
+#include <utility>
 
 #include "../lock/locker.h"
 using namespace std;
@@ -36,6 +40,11 @@ public:
         m_size = 0;                // 队列长度
         m_front = -1;              // 队首下标
         m_back = -1;               // 队尾下标
+        m_waiting = 0;             // 等待的消费者数
+        m_signaled = 0;            // 已唤醒的消费者数
+        m_lingering = 0;           // 批量等待的消费者数
+        m_linger_size = 1;         // 唤醒批量等待的消费者的积压数量
+        m_batch_signaled = false;  // 是否已唤醒批量等待的消费者
     }
 
     // 清空队列
@@ -126,17 +135,12 @@ public:
         return tmp;
     }
 
-    // 往队列添加元素
-    // 需要将所有使用队列的线程先唤醒
+    // 往队列添加元素, 队列满时返回 false
     // 当有元素push进队列, 相当于生产者生产了一个元素
-    // 若当前没有线程等待条件变量, 则唤醒无意义
+    // 只在有消费者等待时唤醒其中一个, 没有线程等待条件变量时不唤醒
     bool push(const T& item) {
-
         m_mutex.lock();
-        // 队列满
         if (m_size >= m_max_size) {
-            // 唤醒等待条件变量的线程
-            m_cond.broadcast();
             m_mutex.unlock();
             return false;
         }
@@ -144,31 +148,59 @@ public:
         // 将新增数据放在循环数组的对应位置
         m_back = (m_back + 1) % m_max_size;
         m_array[m_back] = item;
+        m_size++;
 
+        notify(1);
+        m_mutex.unlock();
+        return true;
+    }
+
+    // 移入元素, 避免复制; 与空出位置中的旧元素交换, item 得到其缓冲区, 可复用
+    bool push(T&& item) {
+        m_mutex.lock();
+        if (m_size >= m_max_size) {
+            m_mutex.unlock();
+            return false;
+        }
+
+        m_back = (m_back + 1) % m_max_size;
+        std::swap(m_array[m_back], item);
         m_size++;
 
-        m_cond.broadcast();
+        notify(1);
         m_mutex.unlock();
         return true;
     }
 
+    // 按顺序移入 items 中的 n 个元素, 队列满时停止, 返回放入的个数
+    int push_batch(T* items, int n) {
+        m_mutex.lock();
+        int count = 0;
+        while (count < n && m_size < m_max_size) {
+            m_back = (m_back + 1) % m_max_size;
+            std::swap(m_array[m_back], items[count++]);
+            m_size++;
+        }
+
+        notify(count);
+        m_mutex.unlock();
+        return count;
+    }
+
     // 取队头元素
     bool pop(T& item) {
 
         m_mutex.lock();
         // 如果当前队列没有元素, 将会等待条件变量
         while (m_size <= 0) {
-
-            if (!m_cond.wait(m_mutex.get())) {
+            if (!wait()) {
                 m_mutex.unlock();
                 return false;
             }
         }
 
         // 取队头元素
-        m_front = (m_front + 1) % m_max_size;
-        item = m_array[m_front];
-        m_size--;
+        take(item);
         m_mutex.unlock();
         return true;
     }
@@ -176,20 +208,13 @@ public:
     // 取队头元素
     // 增加了超时处理, 将线程阻塞一定的时间长度, 时间到达后, 线程解除阻塞
     bool pop(T& item, int ms_timeout) {
-        struct timespec t = {0, 0};
-        struct timeval  now = {0, 0};
-
-        // 获取当前时间戳
-        gettimeofday(&now, NULL);
+        struct timespec t = deadline(ms_timeout);
 
         m_mutex.lock();
         if (m_size <= 0) {
-            t.tv_sec = now.tv_sec + ms_timeout / 1000;
-            t.tv_nsec = (ms_timeout % 1000) * 1000;
-            if (!m_cond.timewait(m_mutex.get(), t)) {
-                m_mutex.unlock();
-                return false;
-            }
+            ++m_waiting;
+            m_cond.timewait(m_mutex.get(), t);
+            woken();
         }
 
         if (m_size <= 0) {
@@ -197,13 +222,108 @@ public:
             return false;
         }
 
-        m_front = (m_front + 1) % m_max_size;
-        item = m_array[m_front];
-        m_size--;
+        take(item);
         m_mutex.unlock();
         return true;
     }
 
+    // 取出最多 max 个元素放入 items[0..max), 队列为空时等待
+    // 一次唤醒取走积压的元素, 返回取出的个数, 等待失败返回 0
+    int pop_batch(T* items, int max) {
+        m_mutex.lock();
+        while (m_size <= 0) {
+            if (!wait()) {
+                m_mutex.unlock();
+                return 0;
+            }
+        }
+
+        int count = 0;
+        while (count < max && m_size > 0) {
+            take(items[count++]);
+        }
+        m_mutex.unlock();
+        return count;
+    }
+
+    // 取出最多 max 个元素放入 items[0..max), 供不急于处理的消费者使用
+    // 积压不足 max 个且不足队列长度的一半时最多等待 ms_timeout 毫秒, 生产者只在积压达到该数量时唤醒,
+    // 每次唤醒取走更多元素; 返回取出的个数, 超时且队列为空时返回 0
+    int pop_batch(T* items, int max, int ms_timeout) {
+        struct timespec t = deadline(ms_timeout);
+        int             batch = std::max(1, std::min(max, m_max_size / 2));
+
+        m_mutex.lock();
+        if (m_size < batch) {
+            if (m_lingering == 0 || batch < m_linger_size) {
+                m_linger_size = batch;
+            }
+            ++m_lingering;
+            m_batch_cond.timewait(m_mutex.get(), t);
+            --m_lingering;
+            m_batch_signaled = false;
+        }
+
+        int count = 0;
+        while (count < max && m_size > 0) {
+            take(items[count++]);
+        }
+        m_mutex.unlock();
+        return count;
+    }
+
+private:
+    // 当前时间加 ms 毫秒
+    static struct timespec deadline(int ms) {
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+
+        long            nsec = now.tv_usec * 1000L + (ms % 1000) * 1000000L;
+        struct timespec t;
+        t.tv_sec = now.tv_sec + ms / 1000 + nsec / 1000000000L;
+        t.tv_nsec = nsec % 1000000000L;
+        return t;
+    }
+
+    // 唤醒最多 n 个正在等待且尚未被唤醒的消费者, 调用方持有锁
+    // 被唤醒的线程重新加锁前不再重复唤醒, 生产者连续 push 时不会每次都进入内核
+    void notify(int n) {
+        while (n-- > 0 && m_signaled < m_waiting) {
+            ++m_signaled;
+            m_cond.signal();
+        }
+
+        // 批量等待的消费者在积压达到其数量时才唤醒
+        if (m_lingering > 0 && !m_batch_signaled && m_size >= m_linger_size) {
+            m_batch_signaled = true;
+            m_batch_cond.signal();
+        }
+    }
+
+    // 等待条件变量并记录等待的线程数, 调用方持有锁
+    bool wait() {
+        ++m_waiting;
+        bool ok = m_cond.wait(m_mutex.get());
+        woken();
+        return ok;
+    }
+
+    // 等待结束后更新计数, 调用方持有锁
+    void woken() {
+        --m_waiting;
+        if (m_signaled > 0) {
+            --m_signaled;
+        }
+    }
+
+    // 移出队头元素, 调用方持有锁且队列非空
+    // 与 item 交换, item 原来的内容留在空出的位置, 其缓冲区由之后放入的元素复用
+    void take(T& item) {
+        m_front = (m_front + 1) % m_max_size;
+        std::swap(item, m_array[m_front]);
+        m_size--;
+    }
+
 private:
     locker m_mutex; // 互斥锁
     cond   m_cond;  // 条件变量
@@ -213,6 +333,13 @@ private:
     int m_max_size; // 队列最大长度
     int m_front;    // 队头下标
     int m_back;     // 队尾下标
+    int m_waiting;  // 等待条件变量的消费者数
+    int m_signaled; // 已唤醒但尚未重新加锁的消费者数
+
+    cond m_batch_cond;     // 批量等待的消费者在这里等待
+    int  m_lingering;      // 批量等待的消费者数
+    int  m_linger_size;    // 唤醒批量等待的消费者的积压数量
+    bool m_batch_signaled; // 是否已唤醒批量等待的消费者
 };
 
 #endif
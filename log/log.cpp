@@ -10,28 +10,90 @@
  */
 #include "log.h"
 
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
 using namespace std;
 
+// 每个线程缓存当前秒的时间前缀, 同一秒内的日志不再调用 localtime
+struct time_prefix {
+    time_t sec;
+    int    mday;
+    int    len;
+    char   text[32]; // eg. 2023-03-07 13:22:45.
+};
+
+static thread_local time_prefix t_prefix = {-1, 0, 0, {0}};
+static thread_local char*       t_line = NULL; // 当前线程格式化日志的缓冲区
+
 Log::Log() {
     m_count = 0;        // 日志行数
     m_is_async = false; // 是否异步
+    m_is_ring = false;  // 是否环形缓冲区模式
+    m_ring_size = 0;
+    m_stop = false;
+    m_flushing = false;
+    m_level.store(LEVEL_DEBUG, std::memory_order_relaxed);
+    m_fp = NULL;
+    m_binary = NULL;
 }
 
 Log::~Log() {
+    // 环形缓冲区模式下等写线程写完剩余的日志再退出
+    m_rings_lock.lock();
+    m_stop = true;
+    m_drain_cond.broadcast();
+    m_rings_lock.unlock();
+    if (m_is_ring) {
+        pthread_join(m_drain_tid, NULL);
+    }
+    if (m_flushing) {
+        pthread_join(m_flush_tid, NULL);
+    }
     if (m_fp != NULL) {
         fclose(m_fp);
     }
+
+    // 其他线程可能仍在写日志, 只关闭文件, 不释放对象
+    if (m_binary != NULL) {
+        m_binary->close();
+    }
 }
 
-bool Log::init(const char* file_name, int log_buf_size, int split_lines, int max_queue_size) {
+bool Log::init(
+    const char* file_name, int log_buf_size, int split_lines, int max_queue_size, int ring_size,
+    size_t binary_size) {
+
+    // 如果设置了binary_size, 则使用二进制模式, 由 binlog 管理日志文件
+    if (binary_size > 0) {
+        m_binary = new binlog;
+        return m_binary->init(file_name, binary_size, log_buf_size);
+    }
+
+    // 如果设置了ring_size, 则使用环形缓冲区模式
+    if (ring_size > 0) {
+        m_is_ring = true;
+        m_ring_size = 1;
+        while (m_ring_size < (size_t)ring_size) {
+            m_ring_size <<= 1;
+        }
+
+        if (pthread_create(&m_drain_tid, NULL, drain_ring_thread, NULL) != 0) {
+            m_is_ring = false;
+        }
+    }
 
     // 如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1) {
+    else if (max_queue_size >= 1) {
 
         m_is_async = true; // 异步写日志
 
@@ -44,14 +106,12 @@ bool Log::init(const char* file_name, int log_buf_size, int split_lines, int max
         pthread_create(&tid, NULL, flush_log_thread, NULL);
     }
 
-    m_log_buf_size = log_buf_size;       // 日志缓冲区大小
-    m_buf = new char[m_log_buf_size];    // 为缓冲区动态分配内存
-    memset(m_buf, '\0', m_log_buf_size); // 初始化缓冲区
-    m_split_lines = split_lines;         // 日志最大行数
+    m_log_buf_size = log_buf_size; // 日志缓冲区大小, 每个线程一个
+    m_split_lines = split_lines;   // 日志最大行数
 
-    time_t     t = time(NULL);         // 获取当前时间戳
-    struct tm* sys_tm = localtime(&t); // 通过时间戳获取系统时间
-    struct tm  my_tm = *sys_tm;
+    time_t    t = time(NULL); // 获取当前时间戳
+    struct tm my_tm;
+    localtime_r(&t, &my_tm); // 通过时间戳获取系统时间
 
     // "./a/b/c" -> "/c"
     // "a" -> NULL
@@ -77,114 +137,390 @@ bool Log::init(const char* file_name, int log_buf_size, int split_lines, int max
     m_today = my_tm.tm_mday; // 日志按天分类
 
     // 打开日志文件
-    m_fp = fopen(log_full_name, "a");
+    m_fp = open_file(log_full_name);
     if (m_fp == NULL) {
         return false;
     }
 
+    // 环形缓冲区模式由写线程直接写文件描述符, 其余模式定期刷新文件缓冲区
+    if (!m_is_ring && pthread_create(&m_flush_tid, NULL, flush_timer_thread, NULL) == 0) {
+        m_flushing = true;
+    }
+
     return true;
 }
 
-void Log::write_log(int level, const char* format, ...) {
+FILE* Log::open_file(const char* name) {
+    FILE* fp = fopen(name, "a");
+    if (fp) {
+        setvbuf(fp, NULL, _IOFBF, FILE_BUFFER_SIZE);
+    }
+    return fp;
+}
+
+void Log::set_level(int level) {
+    if (level < LEVEL_DEBUG) {
+        level = LEVEL_DEBUG;
+    }
+    if (level > LEVEL_ERROR) {
+        level = LEVEL_ERROR;
+    }
+    m_level.store(level, std::memory_order_relaxed);
+}
+
+char* Log::format_line(int level, const char* format, va_list valst, int& len) {
+    if (!t_line) {
+        t_line = new char[m_log_buf_size];
+    }
+
     struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);          // 获取当前时间戳
-    time_t     t = now.tv_sec;         // 当前时间的秒数
-    struct tm* sys_tm = localtime(&t); // 秒数格式化, 线程安全
-    struct tm  my_tm = *sys_tm;
+    gettimeofday(&now, NULL); // 获取当前时间戳
+
+    // 秒数变化时才重新格式化日期部分
+    if (now.tv_sec != t_prefix.sec) {
+        struct tm my_tm;
+        localtime_r(&now.tv_sec, &my_tm);
+        t_prefix.len = snprintf(
+            t_prefix.text, sizeof(t_prefix.text), "%d-%02d-%02d %02d:%02d:%02d.",
+            my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min,
+            my_tm.tm_sec);
+        t_prefix.mday = my_tm.tm_mday;
+        t_prefix.sec = now.tv_sec;
+    }
 
     // 日志分级
-    char s[16] = {0};
+    const char* s;
     switch (level) {
         case 0:
-            strcpy(s, "[debug]:");
+            s = "[debug]: ";
             break;
         case 1:
-            strcpy(s, "[info]:");
+            s = "[info]: ";
             break;
         case 2:
-            strcpy(s, "[warn]:");
+            s = "[warn]: ";
             break;
         case 3:
-            strcpy(s, "[erro]:");
+            s = "[erro]: ";
             break;
         default:
-            strcpy(s, "[info]:");
+            s = "[info]: ";
             break;
     }
 
-    // 写入一个 log
-    // m_count++, 日志行数
+    // 写入的具体时间内容格式
+    // eg. 2023-03-07 13:22:45.134070 [info]
+    char* buf = t_line;
+    int   n = t_prefix.len;
+    memcpy(buf, t_prefix.text, n);
+    long usec = now.tv_usec;
+    for (int i = 5; i >= 0; --i) {
+        buf[n + i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    n += 6;
+    buf[n++] = ' ';
+    int slen = strlen(s);
+    memcpy(buf + n, s, slen);
+    n += slen;
+
+    // 留出换行符和结尾 \0 的位置, 超长的内容截断
+    int m = vsnprintf(buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m > m_log_buf_size - n - 2) {
+        m = m_log_buf_size - n - 2;
+    }
+    buf[n + m] = '\n';
+    buf[n + m + 1] = '\0';
+    len = n + m + 1;
+    return buf;
+}
+
+void Log::split_file(int lines, int mday) {
+    // 写入 lines 行日志
+    // m_count, 日志行数
     // m_split_lines, 日志最大行数
-    m_mutex.lock();
-    m_count++; // 日志行数 +1
+    long long before = m_count;
+    m_count += lines;
 
-    // 日志时间不是当天 或 日志行数对最大行数求余 == 0
+    // 日志时间不是当天 或 日志行数达到最大行数的倍数
     // 创建新日志
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) {
+    if (m_today == mday && before / m_split_lines == m_count / m_split_lines) {
+        return;
+    }
 
-        char new_log[256] = {0}; // 新日志名
-        fflush(m_fp);            // 刷新缓冲区
-        fclose(m_fp);            // 关闭旧日志文件
-        char tail[16] = {0};     // 日志名中的时间部分
+    time_t    t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
-        // yyyy_mm_dd
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    char new_log[256] = {0}; // 新日志名
+    fflush(m_fp);            // 刷新缓冲区
+    fclose(m_fp);            // 关闭旧日志文件
+    char tail[16] = {0};     // 日志名中的时间部分
 
-        // 日志时间不是当天
-        if (m_today != my_tm.tm_mday) {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday; // 日志时间修改为当天
-            m_count = 0;             // 重置日志行数
-        }
+    // yyyy_mm_dd
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
 
-        // 日志行数为最大行倍数
-        // 即每写满一页日志, 新建一页日志
-        else {
-            // 新建日志名:
-            snprintf(
-                new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");
+    // 日志时间不是当天
+    if (m_today != my_tm.tm_mday) {
+        snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
+        m_today = my_tm.tm_mday; // 日志时间修改为当天
+        m_count = 0;             // 重置日志行数
     }
 
-    m_mutex.unlock(); // 解锁
+    // 日志行数为最大行倍数
+    // 即每写满一页日志, 新建一页日志
+    else {
+        // 新建日志名:
+        snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+    }
+    m_fp = open_file(new_log);
+}
 
+void Log::write_log(int level, const char* format, ...) {
     // 将传入的 format 参数赋值给可变参数列表类型 valst, 便于格式化输出
+    // 格式化在当前线程的缓冲区中进行, 不加锁
     va_list valst;
     va_start(valst, format);
 
-    string log_str;
+    // 二进制模式不格式化, 只记录格式串编号和原始参数
+    if (m_binary) {
+        m_binary->write(level, format, valst);
+        va_end(valst);
+        return;
+    }
 
-    m_mutex.lock(); // 加锁
-    // 写入的具体时间内容格式
-    // eg. 2023-03-07 13:22:45.134070 [info]
-    int n = snprintf(
-        m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ", my_tm.tm_year + 1900, my_tm.tm_mon + 1,
-        my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    int   len = 0;
+    char* line = format_line(level, format, valst, len);
+    va_end(valst);
 
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+    // 环形缓冲区模式下写入当前线程的缓冲区, 不加锁
+    if (m_is_ring) {
+        log_ring* r = thread_ring();
+        if ((size_t)len > r->size) {
+            return;
+        }
 
-    m_mutex.unlock(); // 解锁
+        // 缓冲区已满时唤醒写线程并让出 CPU, 等它腾出空间
+        size_t head = r->head.load(std::memory_order_relaxed);
+        size_t used = head - r->tail.load(std::memory_order_acquire);
+        while ((size_t)len > r->size - used) {
+            m_drain_cond.signal();
+            sched_yield();
+            used = head - r->tail.load(std::memory_order_acquire);
+        }
 
-    // 异步写日志
-    if (m_is_async && !m_log_queue->full()) {
-        // 阻塞队列未满则将日志信息加入阻塞队列
-        m_log_queue->push(log_str);
+        // 写到末尾时折回开头
+        size_t pos = head & (r->size - 1);
+        size_t first = std::min((size_t)len, r->size - pos);
+        memcpy(r->buf + pos, line, first);
+        memcpy(r->buf, line + first, len - first);
+        r->head.store(head + len, std::memory_order_release);
+
+        // 超过一半时提前唤醒写线程, 其余由写线程定时收集
+        if (used + len > r->size / 2) {
+            m_drain_cond.signal();
+        }
+        return;
     }
-    // 阻塞队列满
-    else {
+
+    // 写入一个 log
+    m_mutex.lock();
+    split_file(1, t_prefix.mday);
+
+    // 异步写日志, 阻塞队列未满则将日志信息移入阻塞队列
+    // 每个线程复用一个 string, 与队列交换缓冲区, 不逐条分配内存
+    if (m_is_async) {
+        m_mutex.unlock();
+        static thread_local string t_queued;
+        t_queued.assign(line, len);
+        if (m_log_queue->push(std::move(t_queued))) {
+            return;
+        }
+        m_mutex.lock();
+    }
+
+    // 同步或阻塞队列满
+    fputs(line, m_fp);
+    m_mutex.unlock();
+}
+
+Log::log_ring* Log::thread_ring() {
+    static thread_local log_ring* t_ring = NULL;
+    if (!t_ring) {
+        log_ring* r = new log_ring;
+        r->buf = new char[m_ring_size];
+        r->size = m_ring_size;
+        r->head.store(0, std::memory_order_relaxed);
+        r->tail.store(0, std::memory_order_relaxed);
+
+        // 只在线程第一次写日志时加锁登记
+        m_rings_lock.lock();
+        m_rings.push_back(r);
+        m_rings_lock.unlock();
+        t_ring = r;
+    }
+    return t_ring;
+}
+
+void Log::drain_rings() {
+    std::vector<struct iovec> iov;
+    std::vector<size_t>       heads;
+
+    while (1) {
+        // 收集各缓冲区中已写入的部分, 折回的缓冲区分两段
+        m_rings_lock.lock();
+        iov.clear();
+        heads.resize(m_rings.size());
+        for (size_t i = 0; i < m_rings.size(); ++i) {
+            log_ring* r = m_rings[i];
+            size_t    tail = r->tail.load(std::memory_order_relaxed);
+            size_t    head = r->head.load(std::memory_order_acquire);
+            heads[i] = head;
+            if (head == tail) {
+                continue;
+            }
+            size_t pos = tail & (r->size - 1);
+            size_t first = std::min(head - tail, r->size - pos);
+            iov.push_back({r->buf + pos, first});
+            if (head - tail > first) {
+                iov.push_back({r->buf, head - tail - first});
+            }
+        }
+
+        // 没有日志时等待, 缓冲区过半或 flush 时被提前唤醒; 退出前写完剩余的日志
+        if (iov.empty()) {
+            if (m_stop) {
+                m_rings_lock.unlock();
+                return;
+            }
+            struct timespec t;
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_nsec += 10 * 1000000L;
+            t.tv_sec += t.tv_nsec / 1000000000L;
+            t.tv_nsec %= 1000000000L;
+            m_drain_cond.timewait(m_rings_lock.get(), t);
+            m_rings_lock.unlock();
+            continue;
+        }
+        size_t ring_count = heads.size();
+        m_rings_lock.unlock();
+
+        // 按批统计行数, 切分文件后一次 writev 写入
+        int lines = 0;
+        for (size_t i = 0; i < iov.size(); ++i) {
+            const char* p = (const char*)iov[i].iov_base;
+            lines += std::count(p, p + iov[i].iov_len, '\n');
+        }
+
+        time_t    t = time(NULL);
+        struct tm my_tm;
+        localtime_r(&t, &my_tm);
+
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        split_file(lines, my_tm.tm_mday);
+        int fd = fileno(m_fp);
+        for (size_t i = 0; i < iov.size();) {
+            int     cnt = std::min(iov.size() - i, (size_t)IOV_MAX);
+            ssize_t n = writev(fd, &iov[i], cnt);
+            if (n < 0) {
+                break;
+            }
+
+            // 部分写入时跳过已写的部分继续
+            while (i < iov.size() && (size_t)n >= iov[i].iov_len) {
+                n -= iov[i].iov_len;
+                ++i;
+            }
+            if (n > 0) {
+                iov[i].iov_base = (char*)iov[i].iov_base + n;
+                iov[i].iov_len -= n;
+            }
+        }
         m_mutex.unlock();
+
+        // 写完后才释放缓冲区空间
+        m_rings_lock.lock();
+        for (size_t i = 0; i < ring_count; ++i) {
+            m_rings[i]->tail.store(heads[i], std::memory_order_release);
+        }
+        m_rings_lock.unlock();
     }
+}
 
-    va_end(valst);
+void Log::flush_periodically() {
+    m_rings_lock.lock();
+    while (!m_stop) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += FLUSH_INTERVAL_MS / 1000;
+        t.tv_nsec += (FLUSH_INTERVAL_MS % 1000) * 1000000L;
+        t.tv_sec += t.tv_nsec / 1000000000L;
+        t.tv_nsec %= 1000000000L;
+        m_drain_cond.timewait(m_rings_lock.get(), t);
+        m_rings_lock.unlock();
+        flush();
+        m_rings_lock.lock();
+    }
+    m_rings_lock.unlock();
+}
+
+void Log::flush_on_crash() {
+    // 环形缓冲区中未写出的部分直接 write, 写线程可能正在写同一段, 最多重复几行
+    if (m_is_ring) {
+        int fd = fileno(m_fp);
+        for (size_t i = 0; i < m_rings.size(); ++i) {
+            log_ring* r = m_rings[i];
+            size_t    tail = r->tail.load(std::memory_order_acquire);
+            size_t    head = r->head.load(std::memory_order_acquire);
+            size_t    pos = tail & (r->size - 1);
+            size_t    first = std::min(head - tail, r->size - pos);
+            struct iovec iov[2] = {{r->buf + pos, first}, {r->buf, head - tail - first}};
+            if (writev(fd, iov, 2) < 0) {
+                break;
+            }
+        }
+        return;
+    }
+
+    // 崩溃的线程可能持有 m_mutex 或 FILE 的内部锁, fflush 会在内部锁上死锁;
+    // fflush_unlocked 不取锁, 直接 write 文件缓冲区中未写出的部分
+    if (m_fp) {
+        fflush_unlocked(m_fp);
+    }
+}
+
+void Log::crash_handler(int sig) {
+    get_instance()->flush_on_crash();
+
+    // 注册时设置了 SA_RESETHAND, 重新触发时按默认方式处理, 保留 core dump
+    raise(sig);
+}
+
+void Log::install_crash_handler() {
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+
+    int sigs[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); ++i) {
+        sigaction(sigs[i], &sa, NULL);
+    }
 }
 
 void Log::flush(void) {
+    // 二进制模式写的是映射的页, 进程退出或崩溃后由内核写回文件
+    if (m_binary) {
+        return;
+    }
+
+    // 环形缓冲区模式直接写文件描述符, 只需唤醒写线程
+    if (m_is_ring) {
+        m_drain_cond.signal();
+        return;
+    }
+
     m_mutex.lock();
     // 强制将缓冲区内的数据写入指定的文件, 防止缓冲区被覆盖
     fflush(m_fp);
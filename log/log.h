@@ -2,6 +2,12 @@
  * @file log.h
  * @author Chang Chiang (Chang_Chiang@outlook.com.com)
  * @brief 日志类定义, 懒汉单例模式
+ * 同步模式在调用线程中写文件; 异步模式经阻塞队列交给写线程;
+ * 环形缓冲区模式下每个线程写自己的单生产者单消费者环形缓冲区, 不加锁,
+ * 由写线程批量收集各缓冲区中的日志, 用一次 writev 写入文件
+ * 日志级别可在运行时修改, 低于当前级别的日志在格式化之前就被丢弃; 写文件不再逐条 fflush,
+ * 由后台线程每 FLUSH_INTERVAL_MS 毫秒刷新一次, 进程崩溃时由信号处理函数写出缓冲区中的日志
+ * 二进制模式不格式化日志, 由 binlog 记录格式串编号和原始参数, 用 binlog_decode 转为文本
  * @version 0.1
  * @date 2023-03-12
  *
@@ -15,15 +21,26 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "binlog.h"
 #include "block_queue.h"
 
 using namespace std;
 
+// 日志级别
+enum LOG_LEVEL { LEVEL_DEBUG = 0, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+
 class Log {
 public:
+    static const int FLUSH_INTERVAL_MS = 1000;     // 同步和异步模式下刷新文件缓冲区的间隔
+    static const int FILE_BUFFER_SIZE = 64 * 1024; // 日志文件的 stdio 缓冲区大小
+    static const int ASYNC_BATCH = 256;            // 异步模式写线程每次最多取出的日志条数
+    static const int ASYNC_WAIT_MS = 10;           // 异步模式积压不足一批时写线程最多等待的毫秒数
+
     // C++11以后, 使用局部变量懒汉单例不用加锁
     // 公有静态方法获取实例
     static Log* get_instance() {
@@ -34,14 +51,35 @@ public:
     // 异步写日志
     static void* flush_log_thread(void* args) {
         Log::get_instance()->async_write_log();
+        return NULL;
+    }
+
+    // 环形缓冲区模式的写线程
+    static void* drain_ring_thread(void* args) {
+        Log::get_instance()->drain_rings();
+        return NULL;
+    }
+
+    // 同步和异步模式下定期刷新文件缓冲区的线程
+    static void* flush_timer_thread(void* args) {
+        Log::get_instance()->flush_periodically();
+        return NULL;
     }
 
+    // 致命信号的处理函数, 写出缓冲区中的日志后按默认方式重新触发信号
+    static void crash_handler(int sig);
+
+    // 为 SIGSEGV、SIGBUS、SIGFPE、SIGILL、SIGABRT 注册 crash_handler
+    static void install_crash_handler();
+
     // 初始化日志类
     // 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
     // 异步需要设置阻塞队列的长度，同步不需要设置
+    // ring_size 不为 0 时使用环形缓冲区模式, 为每个线程环形缓冲区的字节数, 向上取整为 2 的幂
+    // binary_size 不为 0 时使用二进制模式, 为每个日志文件的字节数, 写满后换新文件, 不按行数和日期切分
     bool init(
         const char* file_name, int log_buf_size = 8192, int split_lines = 5000000,
-        int max_queue_size = 0);
+        int max_queue_size = 0, int ring_size = 0, size_t binary_size = 0);
 
     // 向日志文件写具体内容
     void write_log(int level, const char* format, ...);
@@ -49,7 +87,24 @@ public:
     // 强制刷新缓冲区
     void flush(void);
 
+    // 设置日志级别, 低于该级别的日志不输出, 可在运行时调用
+    void set_level(int level);
+
+    int get_level() const { return m_level.load(std::memory_order_relaxed); }
+
+    // 该级别的日志是否输出, 在格式化之前检查
+    bool enabled(int level) const { return level >= m_level.load(std::memory_order_relaxed); }
+
 private:
+    // 单个线程的环形缓冲区, 只有该线程写入, 只有写线程读出
+    // head 和 tail 只增不减, 对容量取模得到下标
+    struct log_ring {
+        char*               buf;
+        size_t              size; // 容量, 为 2 的幂
+        std::atomic<size_t> head; // 写入位置, 由所属线程更新
+        std::atomic<size_t> tail; // 读出位置, 由写线程更新
+    };
+
     // 日志类构造函数, 单例模式,私有化
     Log();
 
@@ -57,16 +112,44 @@ private:
     virtual ~Log();
 
     // 异步写日志
-    void* async_write_log() {
-        string single_log;
-        // 从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log)) {
-            m_mutex.lock();                  // 加锁
-            fputs(single_log.c_str(), m_fp); // 写日志文件
-            m_mutex.unlock();                // 解锁
+    void async_write_log() {
+        // 取出的 string 不释放, 下次与队列交换, 缓冲区循环使用
+        std::vector<string> logs(ASYNC_BATCH);
+        while (1) {
+            // 积压到一批或等待 ASYNC_WAIT_MS 毫秒后取出, 加一次锁写入文件
+            int n = m_log_queue->pop_batch(logs.data(), ASYNC_BATCH, ASYNC_WAIT_MS);
+            if (n == 0) {
+                continue;
+            }
+            m_mutex.lock(); // 加锁
+            for (int i = 0; i < n; ++i) {
+                fwrite(logs[i].data(), 1, logs[i].size(), m_fp); // 写日志文件
+            }
+            m_mutex.unlock(); // 解锁
         }
     }
 
+    // 把一行日志格式化到当前线程的缓冲区, 返回缓冲区, len 为长度(含换行符)
+    char* format_line(int level, const char* format, va_list valst, int& len);
+
+    // 写入 lines 行前按日期和行数切分日志文件, mday 为日志的日期, 调用方持有 m_mutex
+    void split_file(int lines, int mday);
+
+    // 取得当前线程的环形缓冲区, 首次调用时创建并登记
+    log_ring* thread_ring();
+
+    // 写线程循环, 收集各线程环形缓冲区中的日志批量写入文件
+    void drain_rings();
+
+    // 刷新线程循环
+    void flush_periodically();
+
+    // 打开日志文件并设置缓冲区
+    FILE* open_file(const char* name);
+
+    // 崩溃时尽力写出日志, 不加锁
+    void flush_on_crash();
+
 private:
     char                 dir_name[128];  // 路径名
     char                 log_name[128];  // log文件名
@@ -79,15 +162,35 @@ private:
     block_queue<string>* m_log_queue;    // 阻塞队列
     bool                 m_is_async;     // 是否同步标志位
     locker               m_mutex;        // 互斥锁
+
+    bool                    m_is_ring;    // 是否环形缓冲区模式
+    size_t                  m_ring_size;  // 每个线程环形缓冲区的字节数
+    std::vector<log_ring*>  m_rings;      // 已登记的环形缓冲区
+    locker                  m_rings_lock; // 保护 m_rings
+    cond                    m_drain_cond; // 唤醒写线程
+    pthread_t               m_drain_tid;  // 写线程
+    pthread_t               m_flush_tid;  // 刷新线程
+    bool                    m_flushing;   // 是否启动了刷新线程
+    bool                    m_stop;       // 写线程和刷新线程是否退出, 由 m_rings_lock 保护
+    std::atomic<int>        m_level;      // 日志级别
+    binlog*                 m_binary;     // 二进制模式, 其他模式为 NULL
 };
 
 // 这四个宏定义在其他文件中使用，主要用于不同类型的日志输出
 // __VA_ARGS__是一个可变参数的宏
 // __VA_ARGS__宏前面加上##的作用在于，当可变参数的个数为0时，会把前面多余的","去掉，否则会编译出错。
 
-#define LOG_DEBUG(format, ...) Log::get_instance()->write_log(0, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...)  Log::get_instance()->write_log(1, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...)  Log::get_instance()->write_log(2, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) Log::get_instance()->write_log(3, format, ##__VA_ARGS__)
+// 先检查级别, 不输出的日志不计算参数也不格式化
+#define LOG_WRITE(level, format, ...)                                                              \
+    do {                                                                                           \
+        if (Log::get_instance()->enabled(level)) {                                                 \
+            Log::get_instance()->write_log(level, format, ##__VA_ARGS__);                          \
+        }                                                                                          \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_WRITE(LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)  LOG_WRITE(LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)  LOG_WRITE(LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_WRITE(LEVEL_ERROR, format, ##__VA_ARGS__)
 
 #endif
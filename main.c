@@ -20,23 +20,77 @@
 
 #include <cassert>
 
+#include "./CGImysql/db_worker.h"
 #include "./CGImysql/sql_connection_pool.h"
+#include "./CGImysql/user_cache.h"
+#include "./CGImysql/user_store.h"
 #include "./http/http_conn.h"
 #include "./lock/locker.h"
 #include "./log/log.h"
+#include "./metrics/metrics.h"
+#include "./reactor/sub_reactor.h"
 #include "./threadpool/threadpool.h"
-#include "./timer/lst_timer.h"
+#include "./timer/time_wheel.h"
 
 #define MAX_FD           65536 // 最大文件描述符
 #define MAX_EVENT_NUMBER 10000 // 最大事件数
 #define TIMESLOT         5     // 最小超时单位
+#define LISTEN_BACKLOG   1024  // 监听队列长度, 实际上限受 net.core.somaxconn 限制
+#define DB_THREAD_NUMBER 2     // 数据库线程数, 处理请求时从连接池取连接
+#define DB_MIN_CONN      2     // 连接池最少保持的连接数
+#define DB_MAX_CONN      8     // 连接池最多的连接数
+#define DB_ACQUIRE_MS    1000  // 数据库线程取连接的最长等待毫秒数, 超时的请求返回 500
+#define GROUP_COMMIT_US  0     // 注册合并为多行 INSERT 时最长等待的微秒数, 为 0 时逐条插入
 
 #define SYNLOG // 同步写日志
 // #define ASYNLOG // 异步写日志
+// #define RINGLOG // 每个线程写自己的环形缓冲区, 由写线程批量写日志
+// #define BINLOG // 二进制日志, 只记录格式串编号和原始参数, 用 binlog_decode 转为文本
+#define LOG_LEVEL LEVEL_INFO // 启动时的日志级别, 运行时 SIGUSR1 降低一级, SIGUSR2 提高一级
 
 // #define listenfdET // 边缘触发非阻塞
 #define listenfdLT // 水平触发阻塞
 
+// #define MULTI_REACTOR // 多 Reactor 模式(one loop per thread), 默认为半同步/半反应堆
+#define SUB_REACTOR_NUMBER 4                            // 子反应堆线程数
+#define DISPATCH_MODE      sub_reactor_pool::ROUND_ROBIN // 新连接分发策略, 或 LEAST_LOAD
+
+// 多 Reactor 模式下, 每个子反应堆各开一个 SO_REUSEPORT 监听套接字并自行 accept
+// #define REUSEPORT_LISTEN
+#define REUSEPORT_CPU_AFFINITY false // 子反应堆绑核, 并挂载按 CPU 选择套接字的 BPF 程序
+
+#if defined(REUSEPORT_LISTEN) && !defined(MULTI_REACTOR)
+    #error "REUSEPORT_LISTEN 需要同时打开 MULTI_REACTOR"
+#endif
+
+// 线程池请求队列, 默认为互斥锁 + 链表
+// #define LOCKFREE_QUEUE // 无锁环形队列
+// #define WORK_STEALING  // 工作窃取, 每个工作线程一个本地队列
+
+#if defined(LOCKFREE_QUEUE)
+typedef threadpool<http_conn, ring_work_queue<http_conn> > http_threadpool;
+#elif defined(WORK_STEALING)
+typedef threadpool<http_conn, stealing_work_queue<http_conn> > http_threadpool;
+#else
+typedef threadpool<http_conn> http_threadpool;
+#endif
+
+#if defined(WORK_STEALING) && defined(MULTI_REACTOR)
+    #error "WORK_STEALING 作用于线程池, 多 Reactor 模式下不创建线程池"
+#endif
+
+// 准入控制: 排队时间持续 QUEUE_INTERVAL_MS 高于 QUEUE_TARGET_MS 时判为过载,
+// 过载或队列已满时新请求直接回复 503 和 Retry-After, 不再入队等待
+#define THREAD_NUMBER      8     // 工作线程数
+#define QUEUE_MAX_REQUESTS 10000 // 请求队列长度上限
+#define QUEUE_TARGET_MS    5     // 可以接受的排队时间
+#define QUEUE_INTERVAL_MS  100   // 排队时间持续高于 target 多久判为过载
+// #define PAUSE_ACCEPT_ON_OVERLOAD // 过载时同时暂停 accept, 新连接留在监听队列中
+
+#if defined(PAUSE_ACCEPT_ON_OVERLOAD) && (defined(MULTI_REACTOR) || defined(REUSEPORT_LISTEN))
+    #error "PAUSE_ACCEPT_ON_OVERLOAD 只用于半同步/半反应堆模式"
+#endif
+
 // 这三个函数在 http_conn.cpp 中定义，改变链接属性
 extern int addfd(int epollfd, int fd, bool one_shot);
 extern int remove(int epollfd, int fd);
@@ -44,8 +98,9 @@ extern int setnonblocking(int fd);
 
 // 设置定时器相关参数
 static int pipefd[2];
-static sort_timer_lst timer_lst;
+static time_wheel timer_wheel;
 static int epollfd = 0;
+static http_conn_table* conn_table = NULL; // 连接表, 供定时器回调关闭连接
 
 // 信号处理函数
 void sig_handler(int sig) {
@@ -68,20 +123,75 @@ void addsig(int sig, void(handler)(int), bool restart = true) {
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-// 定时处理任务，重新定时以不断触发SIGALRM信号
+// 定时处理任务, 处理时间轮上所有到期的定时器
 void timer_handler() {
-    timer_lst.tick();
-    alarm(TIMESLOT);
+    timer_wheel.tick();
 }
 
+// 定期记录定时器、读写缓冲区对象池、连接表和文件缓存的使用情况
+void log_memory_stats(http_conn_table& users) {
+    pool_stats timers = object_pool<util_timer>::get_instance()->stats();
+    pool_stats writes = object_pool<http_conn::write_block>::get_instance()->stats();
+    LOG_INFO(
+        "timer pool allocs %ld in use %d capacity %d slabs %d", timers.allocs, timers.in_use,
+        timers.capacity, timers.slabs);
+    for (int i = 0; i < chain_buffer::SEGMENT_CLASSES; ++i) {
+        pool_stats reads = chain_buffer::segment_stats(i);
+        LOG_INFO(
+            "read segment %d pool allocs %ld in use %d capacity %d", chain_buffer::segment_size(i),
+            reads.allocs, reads.in_use, reads.capacity);
+    }
+    LOG_INFO(
+        "write buffer pool allocs %ld in use %d capacity %d", writes.allocs, writes.in_use,
+        writes.capacity);
+    LOG_INFO("conn table created %d of %d", users.created(), users.size());
+    file_cache_stats files = file_cache::get_instance()->stats();
+    LOG_INFO(
+        "file cache entries %d bytes %ld hits %ld misses %ld evictions %ld", files.entries,
+        files.bytes, files.hits, files.misses, files.evictions);
+    user_store_stats accounts = user_store::get_instance()->stats();
+    LOG_INFO("user store users %ld bytes %ld", accounts.users, accounts.bytes);
+    connection_pool_stats db = connection_pool::GetInstance()->stats();
+    LOG_INFO(
+        "db pool total %d busy %d acquires %ld waits %ld timeouts %ld wait avg %ld us max %ld us "
+        "reconnects %ld reaped %ld dropped %ld",
+        db.total, db.busy, db.acquires, db.waits, db.timeouts,
+        db.waits ? db.wait_us / db.waits : 0, db.max_wait_us, db.reconnects, db.reaped,
+        db.dropped);
+    user_cache_stats cached = user_cache::get_instance()->stats();
+    LOG_INFO(
+        "user cache entries %d hits %ld misses %ld loads %ld evictions %ld", cached.entries,
+        cached.hits, cached.misses, cached.loads, cached.evictions);
+}
+
+#ifdef WORK_STEALING
+// 定期记录各工作线程本地队列深度和窃取次数
+void log_worker_stats(http_threadpool* pool) {
+    stealing_work_queue<http_conn>* queue = pool->get_queue();
+    for (int i = 0; i < pool->thread_number(); ++i) {
+        LOG_INFO("worker %d depth %d steals %ld", i, queue->depth(i), queue->steals(i));
+    }
+}
+#endif
+
 // 定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
+// 同时把连接的读写缓冲区归还对象池, 内存随活动连接数而不是曾用过的最大 fd 增长
+// 连接仍在线程池或数据库线程中时缓冲区归处理线程使用, 推迟到下一个超时周期再关闭
 void cb_func(client_data* user_data) {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-    LOG_INFO("close fd %d", user_data->sockfd);
-    Log::get_instance()->flush();
+    http_conn& conn = (*conn_table)[user_data->sockfd];
+    if (conn.busy()) {
+        util_timer* timer = new util_timer;
+        timer->user_data = user_data;
+        timer->cb_func = cb_func;
+        timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
+        user_data->timer = timer;
+        timer_wheel.add_timer(timer);
+        LOG_DEBUG("postpone close fd %d", user_data->sockfd);
+        return;
+    }
+    conn.close_conn();
+    LOG_DEBUG("close fd %d", user_data->sockfd);
 }
 
 // 向客户端发送错误信息
@@ -93,13 +203,23 @@ void show_error(int connfd, const char* info) {
 
 int main(int argc, char* argv[]) {
 #ifdef ASYNLOG
-    Log::get_instance()->init("./tmp/ServerLog", 2000, 800000, 8); // 异步日志模型
+    Log::get_instance()->init("./tmp/ServerLog", 2000, 800000, 1024); // 异步日志模型
 #endif
 
 #ifdef SYNLOG
     Log::get_instance()->init("./tmp/ServerLog", 2000, 800000, 0); // 同步日志模型
 #endif
 
+#ifdef RINGLOG
+    Log::get_instance()->init("./tmp/ServerLog", 2000, 800000, 0, 1 << 18); // 环形缓冲区日志模型
+#endif
+
+#ifdef BINLOG
+    Log::get_instance()->init("./tmp/ServerLog", 2000, 800000, 0, 0, 64 << 20); // 二进制日志模型
+#endif
+    Log::get_instance()->set_level(LOG_LEVEL);
+    Log::install_crash_handler(); // 崩溃时写出缓冲区中的日志
+
     if (argc <= 1) {
         printf("usage: %s ip_address port_number\n", basename(argv[0]));
         return 1;
@@ -112,25 +232,61 @@ int main(int argc, char* argv[]) {
 
     // 创建数据库连接池
     connection_pool* connPool = connection_pool::GetInstance();
-    // connPool->init("localhost", "root", "root", "qgydb", 3306, 8);
-    connPool->init("localhost", "debian-sys-maint", "8tMp4GgzNQ7DtCo7", "web_server_demo", 3306, 8);
+    // connPool->init("localhost", "root", "root", "qgydb", 3306, DB_MAX_CONN, DB_MIN_CONN);
+    connPool->init(
+        "localhost", "debian-sys-maint", "8tMp4GgzNQ7DtCo7", "web_server_demo", 3306, DB_MAX_CONN,
+        DB_MIN_CONN);
 
-    // 创建线程池
-    threadpool<http_conn>* pool = NULL;
+    // 创建数据库线程, 只有注册等需要访问数据库的请求交给它处理
+    db_worker<http_conn>* db = NULL;
     try {
-        pool = new threadpool<http_conn>(connPool);
+        db = new db_worker<http_conn>(
+            connPool, DB_THREAD_NUMBER, 10000, GROUP_COMMIT_US, connection_pool::MAX_INSERT_ROWS,
+            DB_ACQUIRE_MS);
     }
     catch (...) {
         return 1;
     }
+    http_conn::set_db_worker(db);
 
-    // 创建 MAX_FD 个 http 类对象
-    http_conn* users = new http_conn[MAX_FD];
-    assert(users);
+    // 创建线程池, 多 Reactor 模式下由子反应堆线程自行处理业务逻辑
+    http_threadpool* pool = NULL;
+#ifndef MULTI_REACTOR
+    try {
+        pool = new http_threadpool(
+            THREAD_NUMBER, QUEUE_MAX_REQUESTS, QUEUE_TARGET_MS, QUEUE_INTERVAL_MS);
+    }
+    catch (...) {
+        return 1;
+    }
+#endif
+
+    // 创建连接表, http 类对象在对应 fd 第一次被使用时才创建
+    http_conn_table users(MAX_FD);
+    conn_table = &users;
 
     // 初始化数据库读取表
-    users->initmysql_result(connPool);
+    http_conn::initmysql_result(connPool);
+
+    // 编译路由表
+    http_conn::init_routes();
+
+    // 抓取 /metrics 时读取的瞬时值
+    metrics::get_instance()->add_gauge(
+        "webserver_active_connections", "Open client connections",
+        [] { return (long)http_conn::m_user_count.load(); });
+    if (pool) {
+        metrics::get_instance()->add_gauge(
+            "webserver_queue_depth", "Requests waiting in the thread pool queue",
+            [pool] { return (long)pool->queue_size(); });
+    }
+
+    int ret = 0;
 
+#ifdef REUSEPORT_LISTEN
+    // 监听套接字由各子反应堆创建
+    int listenfd = -1;
+#else
     // 创建监听套接字
     int listenfd = socket(PF_INET, SOCK_STREAM, 0);
     assert(listenfd >= 0);
@@ -146,7 +302,6 @@ int main(int argc, char* argv[]) {
     address.sin_addr.s_addr = htonl(INADDR_ANY);
     address.sin_port = htons(port);
 
-    int ret = 0;
     int flag = 1;
 
     // 设置 socket 端口重用选项
@@ -157,19 +312,19 @@ int main(int argc, char* argv[]) {
     assert(ret >= 0);
 
     // 监听
-    ret = listen(listenfd, 5);
+    ret = listen(listenfd, LISTEN_BACKLOG);
     assert(ret >= 0);
+#endif
 
     // 创建内核事件表
     epoll_event events[MAX_EVENT_NUMBER];
     epollfd = epoll_create(5);
     assert(epollfd != -1);
 
+#ifndef REUSEPORT_LISTEN
     // 监听套接字注册到内核事件表
     addfd(epollfd, listenfd, false);
-
-    // 将上述 epollfd 赋值给 http 类对象的 m_epollfd 属性(静态成员变量)
-    http_conn::m_epollfd = epollfd;
+#endif
 
     // 创建管道, 注册 pipefd[0] 上的可读事件
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
@@ -178,19 +333,66 @@ int main(int argc, char* argv[]) {
     addfd(epollfd, pipefd[0], false);
 
     // 设置信号处理函数
-    addsig(SIGALRM, sig_handler, false);
     addsig(SIGTERM, sig_handler, false);
+    addsig(SIGUSR1, sig_handler, false);
+    addsig(SIGUSR2, sig_handler, false);
     bool stop_server = false;
 
     client_data* users_timer = new client_data[MAX_FD];
 
-    bool timeout = false;
-    alarm(TIMESLOT);
+#ifdef MULTI_REACTOR
+    // 创建子反应堆, 主线程只负责 accept 和信号
+    sub_reactor_pool* reactors = NULL;
+    try {
+        reactors = new sub_reactor_pool(
+            SUB_REACTOR_NUMBER, DISPATCH_MODE, &users, users_timer, TIMESLOT, MAX_FD);
+    }
+    catch (...) {
+        return 1;
+    }
+#ifdef REUSEPORT_LISTEN
+    if (!reactors->listen_reuseport(port, LISTEN_BACKLOG, REUSEPORT_CPU_AFFINITY)) {
+        return 1;
+    }
+#endif
+    reactors->start();
+#endif
+
+    time_t next_stats = timer_now_ms() + TIMESLOT * 1000; // 下一次记录统计信息的时间
+#ifdef PAUSE_ACCEPT_ON_OVERLOAD
+    bool accepting = true; // 监听套接字是否在内核事件表中
+#endif
 
     while (!stop_server) {
 
         // 等待所监控文件描述符上有事件的产生
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        // 超时时间取时间轮上最近的到期时间, 不再依赖 SIGALRM 周期性唤醒
+        // 同时不晚于下一次记录统计信息的时间
+        int timeout = timer_wheel.wait_timeout();
+        time_t stats_wait = next_stats - timer_now_ms();
+        int    stats_timeout = stats_wait > 0 ? (int)stats_wait : 0;
+        if (timeout < 0 || timeout > stats_timeout) {
+            timeout = stats_timeout;
+        }
+#ifdef PAUSE_ACCEPT_ON_OVERLOAD
+        // 过载时不再从监听队列取新连接, 解除后恢复; 暂停期间至少每 10ms 检查一次
+        bool overloaded = pool->overloaded();
+        if (overloaded == accepting) {
+            if (overloaded) {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, listenfd, 0);
+                LOG_WARN("%s", "overloaded, stop accepting");
+            }
+            else {
+                addfd(epollfd, listenfd, false);
+                LOG_WARN("%s", "load recovered, accepting again");
+            }
+            accepting = !overloaded;
+        }
+        if (!accepting && (timeout < 0 || timeout > 10)) {
+            timeout = 10;
+        }
+#endif
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, timeout);
         if (number < 0 && errno != EINTR) {
             LOG_ERROR("%s", "epoll failure");
             break;
@@ -218,19 +420,24 @@ int main(int argc, char* argv[]) {
                     LOG_ERROR("%s", "Internal server busy");
                     continue;
                 }
-                users[connfd].init(connfd, client_address);
+#ifdef MULTI_REACTOR
+                // 新连接交给子反应堆
+                reactors->dispatch(connfd, client_address);
+#else
+                users[connfd].init(connfd, client_address, epollfd);
 
                 // 初始化 client_data 数据
-                // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+                // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到时间轮中
                 users_timer[connfd].address = client_address;
                 users_timer[connfd].sockfd = connfd;
+                users_timer[connfd].epollfd = epollfd;
                 util_timer* timer = new util_timer;
                 timer->user_data = &users_timer[connfd];
                 timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
+                timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
                 users_timer[connfd].timer = timer;
-                timer_lst.add_timer(timer);
+                timer_wheel.add_timer(timer);
+#endif
 #endif
 
 // ET非阻塞边缘触发
@@ -248,19 +455,23 @@ int main(int argc, char* argv[]) {
                         LOG_ERROR("%s", "Internal server busy");
                         break;
                     }
-                    users[connfd].init(connfd, client_address);
+#ifdef MULTI_REACTOR
+                    reactors->dispatch(connfd, client_address);
+#else
+                    users[connfd].init(connfd, client_address, epollfd);
 
                     // 初始化client_data数据
-                    // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+                    // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到时间轮中
                     users_timer[connfd].address = client_address;
                     users_timer[connfd].sockfd = connfd;
+                    users_timer[connfd].epollfd = epollfd;
                     util_timer* timer = new util_timer;
                     timer->user_data = &users_timer[connfd];
                     timer->cb_func = cb_func;
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
+                    timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
                     users_timer[connfd].timer = timer;
-                    timer_lst.add_timer(timer);
+                    timer_wheel.add_timer(timer);
+#endif
                 }
                 continue;
 #endif
@@ -273,7 +484,7 @@ int main(int argc, char* argv[]) {
                 timer->cb_func(&users_timer[sockfd]);
 
                 if (timer) {
-                    timer_lst.del_timer(timer);
+                    timer_wheel.del_timer(timer);
                 }
             }
 
@@ -291,12 +502,17 @@ int main(int argc, char* argv[]) {
                 else {
                     for (int i = 0; i < ret; ++i) {
                         switch (signals[i]) {
-                            case SIGALRM: {
-                                timeout = true;
-                                break;
-                            }
                             case SIGTERM: {
                                 stop_server = true;
+                                break;
+                            }
+                            // 运行时调整日志级别
+                            case SIGUSR1:
+                            case SIGUSR2: {
+                                Log* log = Log::get_instance();
+                                log->set_level(log->get_level() + (signals[i] == SIGUSR1 ? -1 : 1));
+                                LOG_WARN("log level %d", log->get_level());
+                                break;
                             }
                         }
                     }
@@ -308,29 +524,30 @@ int main(int argc, char* argv[]) {
                 util_timer* timer = users_timer[sockfd].timer;
                 // 读入对应缓冲区
                 if (users[sockfd].read_once()) {
-                    LOG_INFO(
+                    LOG_DEBUG(
                         "deal with the client(%s)",
                         inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
 
                     // 若监测到读事件, 将该事件放入请求队列
-                    pool->append(users + sockfd);
+                    // 队列已满或过载时直接回复 503, 发送完后关闭连接
+                    users[sockfd].set_busy();
+                    if (!pool->append(users.get(sockfd))) {
+                        users[sockfd].reject();
+                    }
 
                     // 若有数据传输, 则将定时器往后延迟3个单位
-                    // 并对新的定时器在链表上的位置进行调整
+                    // 并调整定时器在时间轮上的位置
                     if (timer) {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+                        timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
+                        LOG_DEBUG("%s", "adjust timer once");
+                        timer_wheel.adjust_timer(timer);
                     }
                 }
                 // 服务器关闭连接
                 else {
                     timer->cb_func(&users_timer[sockfd]);
                     if (timer) {
-                        timer_lst.del_timer(timer);
+                        timer_wheel.del_timer(timer);
                     }
                 }
             }
@@ -338,39 +555,55 @@ int main(int argc, char* argv[]) {
             else if (events[i].events & EPOLLOUT) {
                 util_timer* timer = users_timer[sockfd].timer;
                 if (users[sockfd].write()) {
-                    LOG_INFO(
+                    LOG_DEBUG(
                         "send data to the client(%s)",
                         inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
+
+                    // 缓冲区中还有流水线发来的请求, 不等读事件, 直接放入请求队列
+                    if (users[sockfd].has_pipelined_request()) {
+                        users[sockfd].set_busy();
+                        if (!pool->append(users.get(sockfd))) {
+                            users[sockfd].reject();
+                        }
+                    }
 
                     // 若有数据传输，则将定时器往后延迟3个单位
-                    // 并对新的定时器在链表上的位置进行调整
+                    // 并调整定时器在时间轮上的位置
                     if (timer) {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+                        timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
+                        LOG_DEBUG("%s", "adjust timer once");
+                        timer_wheel.adjust_timer(timer);
                     }
                 }
                 else {
                     timer->cb_func(&users_timer[sockfd]);
                     if (timer) {
-                        timer_lst.del_timer(timer);
+                        timer_wheel.del_timer(timer);
                     }
                 }
             }
         }
-        if (timeout) {
+        // 处理到期的定时器
+        if (timer_wheel.wait_timeout() == 0) {
             timer_handler();
-            timeout = false;
+        }
+        if (timer_now_ms() >= next_stats) {
+            log_memory_stats(users);
+#ifdef WORK_STEALING
+            log_worker_stats(pool);
+#endif
+            next_stats = timer_now_ms() + TIMESLOT * 1000;
         }
     }
+#ifdef MULTI_REACTOR
+    delete reactors; // 先回收子反应堆线程, 再释放其引用的数组
+#endif
     close(epollfd);
-    close(listenfd);
+    if (listenfd != -1) {
+        close(listenfd);
+    }
     close(pipefd[1]);
     close(pipefd[0]);
-    delete[] users;
     delete[] users_timer;
     delete pool;
     return 0;
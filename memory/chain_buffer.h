@@ -0,0 +1,204 @@
+/**
+ * @file chain_buffer.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 链式读缓冲区
+ * 由若干段组成, 段从 4 KB、8 KB、16 KB 三档对象池中分配, 超过 16 KB 的请求体直接向堆申请
+ * 只有最后一段(当前段)接收新数据, 已解析的段保持不动, 指向其中的指针一直有效;
+ * 当前段写满时只把尚未解析完的部分复制到新段开头, 不对整个缓冲区做 memmove
+ * @version 0.1
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+
+#include <string.h>
+
+#include <new>
+
+#include "object_pool.h"
+
+class chain_buffer {
+public:
+    static const int SEGMENT_CLASSES = 3;     // 池化段的档数
+    static const int MIN_SEGMENT_SIZE = 4096; // 第一段大小, 小的 GET 请求只占用这一段
+
+    chain_buffer() : m_head(NULL), m_tail(NULL), m_segments(0) {}
+    ~chain_buffer() { clear(); }
+
+    // 当前段的数据区与容量, 没有段时为 NULL 和 0
+    char* data() { return m_tail ? m_tail->data() : NULL; }
+    int   capacity() const { return m_tail ? m_tail->capacity : 0; }
+
+    // 段数
+    int segments() const { return m_segments; }
+
+    // 没有段时分配第一段, 并清零
+    bool reserve() {
+        if (m_tail) {
+            return true;
+        }
+        segment* seg = new_segment(0, 0);
+        if (!seg) {
+            return false;
+        }
+        memset(seg->data(), '\0', seg->capacity);
+        append(seg);
+        return true;
+    }
+
+    // 当前段写满时换到新段: 把当前段 [from, end) 复制到新段开头
+    // 新段容量至少为 need, 且不小于下一档, 使连续的大请求段数按档位增长
+    bool extend(int from, int end, int need) {
+        if (need < end - from) {
+            need = end - from;
+        }
+        int size_class = m_tail ? m_tail->size_class + 1 : 0;
+        segment* seg = new_segment(size_class, need);
+        if (!seg) {
+            return false;
+        }
+        if (m_tail && end > from) {
+            memcpy(seg->data(), m_tail->data() + from, end - from);
+        }
+        memset(seg->data() + (end - from), '\0', seg->capacity - (end - from));
+        append(seg);
+        return true;
+    }
+
+    // 一轮请求处理完后, 把当前段 [from, end) 复制到新的第一段开头, 归还其余各段
+    // 流水线中的后续请求不再占用为之前的大请求分配的段
+    bool compact(int from, int end) {
+        segment* seg = new_segment(0, end - from);
+        if (!seg) {
+            return false;
+        }
+        memcpy(seg->data(), m_tail->data() + from, end - from);
+        memset(seg->data() + (end - from), '\0', seg->capacity - (end - from));
+        clear();
+        append(seg);
+        return true;
+    }
+
+    // 归还所有段
+    void clear() {
+        while (m_head) {
+            segment* next = m_head->next;
+            free_segment(m_head);
+            m_head = next;
+        }
+        m_tail = NULL;
+        m_segments = 0;
+    }
+
+    // 池化段的最大可用容量, 超过该长度的数据只能放在向堆申请的大段中
+    static int max_segment_capacity() {
+        return segment_size(SEGMENT_CLASSES - 1) - (int)sizeof(segment);
+    }
+
+    // 第 size_class 档段的大小
+    static int segment_size(int size_class) { return MIN_SEGMENT_SIZE << size_class; }
+
+    // 第 size_class 档对象池的统计信息
+    static pool_stats segment_stats(int size_class) {
+        switch (size_class) {
+            case 0:
+                return object_pool<block<0> >::get_instance()->stats();
+            case 1:
+                return object_pool<block<1> >::get_instance()->stats();
+            default:
+                return object_pool<block<2> >::get_instance()->stats();
+        }
+    }
+
+private:
+    // 段头部, 数据区紧随其后
+    struct segment {
+        segment* next;
+        int      capacity;   // 数据区大小
+        int      size_class; // 所属档位, -1 表示向堆申请的大段
+        char*    data() { return (char*)(this + 1); }
+    };
+
+    // 各档对象池分配的定长内存块
+    template <int SIZE_CLASS>
+    struct block {
+        char data[MIN_SEGMENT_SIZE << SIZE_CLASS];
+    };
+
+    // 从不小于 size_class 且能容纳 need 字节的档位分配段, 都放不下时向堆申请
+    static segment* new_segment(int size_class, int need) {
+        if (size_class >= SEGMENT_CLASSES) {
+            size_class = SEGMENT_CLASSES - 1;
+        }
+        while (size_class < SEGMENT_CLASSES &&
+               segment_size(size_class) - (int)sizeof(segment) < need) {
+            ++size_class;
+        }
+
+        void* mem = NULL;
+        int   size = 0;
+        switch (size_class) {
+            case 0:
+                mem = object_pool<block<0> >::get_instance()->allocate();
+                break;
+            case 1:
+                mem = object_pool<block<1> >::get_instance()->allocate();
+                break;
+            case 2:
+                mem = object_pool<block<2> >::get_instance()->allocate();
+                break;
+            default:
+                size_class = -1;
+                mem = ::operator new(sizeof(segment) + need, std::nothrow);
+                break;
+        }
+        if (!mem) {
+            return NULL;
+        }
+        size = size_class < 0 ? (int)sizeof(segment) + need : segment_size(size_class);
+
+        segment* seg = (segment*)mem;
+        seg->next = NULL;
+        seg->capacity = size - (int)sizeof(segment);
+        seg->size_class = size_class;
+        return seg;
+    }
+
+    static void free_segment(segment* seg) {
+        switch (seg->size_class) {
+            case 0:
+                object_pool<block<0> >::get_instance()->deallocate(seg);
+                break;
+            case 1:
+                object_pool<block<1> >::get_instance()->deallocate(seg);
+                break;
+            case 2:
+                object_pool<block<2> >::get_instance()->deallocate(seg);
+                break;
+            default:
+                ::operator delete(seg);
+                break;
+        }
+    }
+
+    void append(segment* seg) {
+        if (m_tail) {
+            m_tail->next = seg;
+        }
+        else {
+            m_head = seg;
+        }
+        m_tail = seg;
+        ++m_segments;
+    }
+
+private:
+    segment* m_head;     // 第一段, 释放时从这里开始
+    segment* m_tail;     // 当前段, 新数据写入这里
+    int      m_segments; // 段数
+};
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * @file object_pool.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 定长对象池与按需创建的连接表
+ * object_pool: 按 slab 批量向堆申请内存, 释放的对象挂到空闲链表上复用,
+ * 用于定时器、读写缓冲区等频繁创建销毁的定长对象
+ * lazy_table: 以 fd 为下标的指针表, 对象在第一次用到该下标时才创建,
+ * 内存随实际连接数增长, 而不是在启动时按 MAX_FD 一次分配
+ * @version 0.1
+ * @date 2023-03-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <new>
+
+#include "../lock/locker.h"
+
+// 对象池统计信息
+struct pool_stats {
+    long allocs;   // 累计分配次数
+    long frees;    // 累计释放次数
+    int  slabs;    // 已向堆申请的 slab 数
+    int  in_use;   // 正在使用的对象数
+    int  capacity; // 已申请的对象总数
+};
+
+// 定长对象池, 只管理内存, 不负责构造和析构
+// 每次空闲链表为空时向堆申请一个 slab, 切分为 SLAB_OBJECTS 个对象
+// slab 不归还给堆, 占用的内存等于历史最大同时使用量
+template <typename T, int SLAB_OBJECTS = 256>
+class object_pool {
+public:
+    // 每种对象一个全局对象池
+    // 不随静态对象析构, 避免全局时间轮等在进程退出时仍向已析构的池归还对象
+    static object_pool* get_instance() {
+        static object_pool* instance = new object_pool;
+        return instance;
+    }
+
+    // 取一个对象的内存
+    void* allocate() {
+        m_locker.lock();
+        if (!m_free_list) {
+            grow();
+        }
+        node* n = m_free_list;
+        m_free_list = n->next;
+        ++m_stats.allocs;
+        ++m_stats.in_use;
+        m_locker.unlock();
+        return n;
+    }
+
+    // 归还对象的内存, 挂回空闲链表
+    void deallocate(void* p) {
+        if (!p) {
+            return;
+        }
+        node* n = static_cast<node*>(p);
+        m_locker.lock();
+        n->next = m_free_list;
+        m_free_list = n;
+        ++m_stats.frees;
+        --m_stats.in_use;
+        m_locker.unlock();
+    }
+
+    pool_stats stats() {
+        m_locker.lock();
+        pool_stats s = m_stats;
+        m_locker.unlock();
+        return s;
+    }
+
+private:
+    // 空闲对象复用自身内存作为链表节点
+    union node {
+        node* next;
+        alignas(T) char data[sizeof(T)];
+    };
+
+    object_pool() : m_free_list(NULL) {
+        m_stats.allocs = 0;
+        m_stats.frees = 0;
+        m_stats.slabs = 0;
+        m_stats.in_use = 0;
+        m_stats.capacity = 0;
+    }
+
+    // 申请一个新的 slab 并把其中的对象串到空闲链表上, 调用方持有锁
+    void grow() {
+        node* slab = new node[SLAB_OBJECTS];
+        for (int i = SLAB_OBJECTS - 1; i >= 0; --i) {
+            slab[i].next = m_free_list;
+            m_free_list = &slab[i];
+        }
+        ++m_stats.slabs;
+        m_stats.capacity += SLAB_OBJECTS;
+    }
+
+private:
+    locker     m_locker; // 多个反应堆线程同时分配
+    node*      m_free_list;
+    pool_stats m_stats;
+};
+
+// 以 fd 为下标、按需创建对象的表
+// 某个下标的对象只由当前负责该 fd 的线程创建和访问, 交给其他线程时由请求队列的锁保证可见性
+// 对象创建后一直保留到进程退出, 同一 fd 复用同一对象
+template <typename T>
+class lazy_table {
+public:
+    explicit lazy_table(int size) : m_size(size), m_created(0) {
+        m_table = new T*[size]();
+    }
+
+    ~lazy_table() {
+        for (int i = 0; i < m_size; ++i) {
+            delete m_table[i];
+        }
+        delete[] m_table;
+    }
+
+    // 取下标对应的对象, 不存在时创建
+    T* get(int index) {
+        T* obj = m_table[index];
+        if (!obj) {
+            obj = new T;
+            m_table[index] = obj;
+            m_created.fetch_add(1, std::memory_order_relaxed);
+        }
+        return obj;
+    }
+
+    T& operator[](int index) { return *get(index); }
+
+    // 已创建的对象数
+    int created() const { return m_created.load(std::memory_order_relaxed); }
+
+    int size() const { return m_size; }
+
+private:
+    int              m_size;
+    std::atomic<int> m_created; // 已创建的对象数, 多个反应堆线程同时创建
+    T**              m_table;
+};
+
+#endif
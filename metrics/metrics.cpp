@@ -0,0 +1,160 @@
+/**
+ * @file metrics.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 延迟直方图与计数器实现
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "metrics.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// 直方图的名称和说明, 与 metrics::HISTOGRAM 顺序一致
+static const char* histogram_names[][2] = {
+    {"webserver_accept_to_first_byte_seconds", "Time from accept to the first response byte sent"},
+    {"webserver_request_parse_seconds", "Time to parse a complete request"},
+    {"webserver_queue_wait_seconds", "Time a request waited in the thread pool queue"},
+    {"webserver_db_acquire_seconds", "Time to acquire a database connection"},
+    {"webserver_time_to_last_byte_seconds", "Time from reading a request to the last byte sent"},
+};
+
+// 计数器的名称和说明, 与 metrics::COUNTER 顺序一致
+static const char* counter_names[][2] = {
+    {"webserver_bytes_sent_total", "Bytes sent to clients"},
+    {"webserver_rejected_requests_total", "Requests rejected with 503 while overloaded"},
+};
+
+// 输出的分位数
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+void latency_histogram::merge_into(uint64_t* counts, uint64_t& sum) const {
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] += m_counts[i].load(std::memory_order_relaxed);
+    }
+    sum += m_sum.load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::bucket_max(int b) {
+    if (b < SUB_COUNT) {
+        return b;
+    }
+    int e = b / SUB_COUNT + SUB_BITS - 1;
+    int shift = e - SUB_BITS;
+    return ((uint64_t)(SUB_COUNT + b % SUB_COUNT) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+metrics* metrics::get_instance() {
+    static metrics instance;
+    return &instance;
+}
+
+int64_t metrics::now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+metrics::shard* metrics::local_shard() {
+    static thread_local shard* t_shard = NULL;
+    if (!t_shard) {
+        t_shard = new shard;
+        metrics* m = get_instance();
+        m->m_lock.lock();
+        m->m_shards.push_back(t_shard);
+        m->m_lock.unlock();
+    }
+    return t_shard;
+}
+
+void metrics::record(HISTOGRAM h, int64_t ns) { local_shard()->histograms[h].record(ns); }
+
+void metrics::add(COUNTER c, uint64_t n) {
+    std::atomic<uint64_t>& v = local_shard()->counters[c];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void metrics::add_gauge(const char* name, const char* help, std::function<long()> read) {
+    gauge g = {name, help, read};
+    m_lock.lock();
+    m_gauges.push_back(g);
+    m_lock.unlock();
+}
+
+void metrics::render_histogram(std::string& out, HISTOGRAM h) {
+    // 调用方持有 m_lock
+    std::vector<uint64_t> counts(latency_histogram::BUCKETS, 0);
+    uint64_t              sum = 0;
+    for (size_t i = 0; i < m_shards.size(); ++i) {
+        m_shards[i]->histograms[h].merge_into(&counts[0], sum);
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i) {
+        total += counts[i];
+    }
+
+    const char* name = histogram_names[h][0];
+    char        buf[256];
+    snprintf(
+        buf, sizeof(buf), "# HELP %s %s\n# TYPE %s summary\n", name, histogram_names[h][1], name);
+    out += buf;
+
+    // 分位数取所在桶的最大值, 没有数据时为 NaN
+    int      b = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+        uint64_t rank = (uint64_t)(quantiles[i] * total + 0.999999);
+        if (rank == 0) {
+            rank = 1;
+        }
+        while (b < latency_histogram::BUCKETS && seen + counts[b] < rank) {
+            seen += counts[b++];
+        }
+        if (total == 0) {
+            snprintf(buf, sizeof(buf), "%s{quantile=\"%g\"} NaN\n", name, quantiles[i]);
+        }
+        else {
+            snprintf(
+                buf, sizeof(buf), "%s{quantile=\"%g\"} %.9g\n", name, quantiles[i],
+                latency_histogram::bucket_max(b) / 1e9);
+        }
+        out += buf;
+    }
+    snprintf(
+        buf, sizeof(buf), "%s_sum %.9g\n%s_count %llu\n", name, sum / 1e9, name,
+        (unsigned long long)total);
+    out += buf;
+}
+
+std::string metrics::render() {
+    std::string out;
+    char        buf[256];
+
+    m_lock.lock();
+    for (int h = 0; h < HISTOGRAM_COUNT; ++h) {
+        render_histogram(out, (HISTOGRAM)h);
+    }
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < m_shards.size(); ++i) {
+            total += m_shards[i]->counters[c].load(std::memory_order_relaxed);
+        }
+        const char* name = counter_names[c][0];
+        snprintf(
+            buf, sizeof(buf), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name,
+            counter_names[c][1], name, name, (unsigned long long)total);
+        out += buf;
+    }
+    for (size_t i = 0; i < m_gauges.size(); ++i) {
+        const gauge& g = m_gauges[i];
+        snprintf(
+            buf, sizeof(buf), "# HELP %s %s\n# TYPE %s gauge\n%s %ld\n", g.name, g.help, g.name,
+            g.name, g.read());
+        out += buf;
+    }
+    m_lock.unlock();
+    return out;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file metrics.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 延迟直方图与计数器, 以 Prometheus 文本格式输出
+ * 每个线程第一次记录时分配自己的一组直方图和计数器, 只有该线程写入,
+ * 记录时不加锁、不做原子读改写; 抓取时合并各线程的数据, 开销只在抓取时
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+// 对数线性分桶的延迟直方图, 单位纳秒
+// 值的最高位决定量级, 其后 SUB_BITS 位决定量级内的子桶, 相对误差不超过 1/2^SUB_BITS
+// 只允许一个线程写入, 其他线程可随时读取
+class latency_histogram {
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(int64_t ns) {
+        uint64_t v = ns > 0 ? ns : 0;
+        std::atomic<uint64_t>& c = m_counts[bucket(v)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    // 各桶计数累加到 counts, 总和累加到 sum
+    void merge_into(uint64_t* counts, uint64_t& sum) const;
+
+    // 值所在的桶
+    static int bucket(uint64_t v) {
+        if (v < (uint64_t)SUB_COUNT) {
+            return v;
+        }
+        int e = 63 - __builtin_clzll(v);
+        return (e - SUB_BITS + 1) * SUB_COUNT + ((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    // 桶内的最大值
+    static uint64_t bucket_max(int b);
+
+private:
+    std::atomic<uint64_t> m_counts[BUCKETS] = {};
+    std::atomic<uint64_t> m_sum{0};
+};
+
+class metrics {
+public:
+    // 延迟直方图
+    enum HISTOGRAM {
+        ACCEPT_TO_FIRST_BYTE = 0, // 接受连接到发出第一个字节
+        PARSE,                    // 解析出一个完整请求的耗时
+        QUEUE_WAIT,               // 在线程池请求队列中等待的时间
+        DB_ACQUIRE,               // 从连接池取得数据库连接的时间
+        TIME_TO_LAST_BYTE,        // 开始读取请求到响应全部发出
+        HISTOGRAM_COUNT
+    };
+
+    // 计数器
+    enum COUNTER {
+        BYTES_SENT = 0, // 发出的字节数
+        REJECTED,       // 过载时以 503 拒绝的请求数
+        COUNTER_COUNT
+    };
+
+    // 单例模式
+    static metrics* get_instance();
+
+    // 单调时钟, 纳秒
+    static int64_t now_ns();
+
+    // 记录一次耗时到当前线程的直方图
+    static void record(HISTOGRAM h, int64_t ns);
+
+    // 当前线程的计数器加 n
+    static void add(COUNTER c, uint64_t n);
+
+    // 注册抓取时读取的瞬时值, 如活动连接数、队列长度
+    void add_gauge(const char* name, const char* help, std::function<long()> read);
+
+    // 合并各线程的数据, 生成 Prometheus 文本格式
+    std::string render();
+
+private:
+    // 一个线程的直方图和计数器, 按缓存行对齐, 不与其他线程共享缓存行
+    struct alignas(64) shard {
+        latency_histogram     histograms[HISTOGRAM_COUNT];
+        std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+    };
+
+    struct gauge {
+        const char*           name;
+        const char*           help;
+        std::function<long()> read;
+    };
+
+    metrics() {}
+
+    // 当前线程的分片, 第一次调用时创建
+    static shard* local_shard();
+
+    void render_histogram(std::string& out, HISTOGRAM h);
+
+private:
+    locker              m_lock;   // 保护分片表和瞬时值表
+    std::vector<shard*> m_shards; // 分片不释放, 线程退出后数据仍计入, 退出时工作线程可能仍在写入
+    std::vector<gauge>  m_gauges;
+};
+
+#endif
@@ -0,0 +1,396 @@
+/**
+ * @file sub_reactor.cpp
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 多 Reactor 模式实现
+ * @version 0.1
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "sub_reactor.h"
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <exception>
+
+#include "../log/log.h"
+
+// 在 http_conn.cpp 中定义
+extern int addfd(int epollfd, int fd, bool one_shot);
+
+// 当前线程所属的子反应堆, 定时器回调据此更新负载
+static thread_local sub_reactor* t_reactor = NULL;
+
+sub_reactor::sub_reactor(
+    int id, http_conn_table* users, client_data* users_timer, int timeslot, int max_fd)
+    : m_id(id)
+    , m_listenfd(-1)
+    , m_timeslot(timeslot)
+    , m_max_fd(max_fd)
+    , m_cpu(-1)
+    , m_stop(false)
+    , m_users(users)
+    , m_users_timer(users_timer)
+    , m_load(0) {
+
+    m_epollfd = epoll_create(5);
+    if (m_epollfd == -1) {
+        throw std::exception();
+    }
+
+    m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeupfd == -1) {
+        close(m_epollfd);
+        throw std::exception();
+    }
+
+    // eventfd 只用于唤醒, 不需要 EPOLLONESHOT
+    addfd(m_epollfd, m_wakeupfd, false);
+}
+
+sub_reactor::~sub_reactor() {
+    if (m_listenfd != -1) {
+        close(m_listenfd);
+    }
+    close(m_wakeupfd);
+    close(m_epollfd);
+}
+
+int sub_reactor::listen_reuseport(int port, int backlog) {
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) {
+        return -1;
+    }
+
+    // 同一端口上的多个套接字组成 reuseport 组, 内核按四元组哈希分配新连接
+    int flag = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) < 0) {
+        close(listenfd);
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (bind(listenfd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listenfd, backlog) < 0) {
+        close(listenfd);
+        return -1;
+    }
+
+    // 水平触发, 非阻塞, 便于一次就绪时循环 accept 直到 EAGAIN
+    addfd(m_epollfd, listenfd, false);
+    m_listenfd = listenfd;
+    return listenfd;
+}
+
+void sub_reactor::start() {
+    if (pthread_create(&m_thread, NULL, worker, this) != 0) {
+        throw std::exception();
+    }
+}
+
+void sub_reactor::stop() {
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+    pthread_join(m_thread, NULL);
+}
+
+bool sub_reactor::add_connection(int connfd, const sockaddr_in& address) {
+    pending_conn conn;
+    conn.connfd = connfd;
+    conn.address = address;
+
+    m_pending_locker.lock();
+    m_pending.push_back(conn);
+    m_pending_locker.unlock();
+
+    // 连接数在分发时即计入, 避免连续分发时最小负载判断失准
+    m_load++;
+
+    uint64_t one = 1;
+    return ::write(m_wakeupfd, &one, sizeof(one)) == sizeof(one);
+}
+
+void* sub_reactor::worker(void* arg) {
+    sub_reactor* reactor = (sub_reactor*)arg;
+    t_reactor = reactor;
+
+    if (reactor->m_cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(reactor->m_cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+            LOG_WARN("reactor %d bind cpu %d failed", reactor->m_id, reactor->m_cpu);
+        }
+    }
+
+    reactor->run();
+    return reactor;
+}
+
+void sub_reactor::cb_func(client_data* user_data) {
+    assert(user_data);
+    http_conn& conn = (*t_reactor->m_users)[user_data->sockfd];
+
+    // 请求还在数据库线程中, 缓冲区归数据库线程使用, 推迟到下一个超时周期再关闭
+    if (conn.busy()) {
+        util_timer* timer = new util_timer;
+        timer->user_data = user_data;
+        timer->cb_func = cb_func;
+        timer->expire = timer_now_ms() + 3 * t_reactor->m_timeslot * 1000;
+        user_data->timer = timer;
+        t_reactor->m_timer_wheel.add_timer(timer);
+        LOG_DEBUG("reactor %d postpone close fd %d", t_reactor->m_id, user_data->sockfd);
+        return;
+    }
+
+    conn.close_conn(); // 同时归还读写缓冲区
+    t_reactor->m_load--;
+    LOG_DEBUG("reactor %d close fd %d", t_reactor->m_id, user_data->sockfd);
+}
+
+void sub_reactor::handle_pending() {
+    uint64_t count;
+    read(m_wakeupfd, &count, sizeof(count));
+
+    std::list<pending_conn> pending;
+    m_pending_locker.lock();
+    pending.swap(m_pending);
+    m_pending_locker.unlock();
+
+    for (std::list<pending_conn>::iterator it = pending.begin(); it != pending.end(); ++it) {
+        register_connection(it->connfd, it->address);
+    }
+}
+
+void sub_reactor::handle_accept() {
+    // 监听套接字为非阻塞, 一次处理完所有已完成握手的连接
+    while (true) {
+        struct sockaddr_in client_address;
+        socklen_t          client_addrlength = sizeof(client_address);
+        int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+        if (connfd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("reactor %d %s:errno is:%d", m_id, "accept error", errno);
+            }
+            break;
+        }
+
+        if (http_conn::m_user_count >= m_max_fd || connfd >= m_max_fd) {
+            const char* info = "Internal server busy";
+            send(connfd, info, strlen(info), 0);
+            close(connfd);
+            LOG_ERROR("%s", "Internal server busy");
+            continue;
+        }
+
+        m_load++;
+        register_connection(connfd, client_address);
+    }
+}
+
+void sub_reactor::register_connection(int connfd, const sockaddr_in& address) {
+    (*m_users)[connfd].init(connfd, address, m_epollfd);
+
+    // 初始化 client_data 数据
+    // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到本反应堆的时间轮中
+    m_users_timer[connfd].address = address;
+    m_users_timer[connfd].sockfd = connfd;
+    m_users_timer[connfd].epollfd = m_epollfd;
+    util_timer* timer = new util_timer;
+    timer->user_data = &m_users_timer[connfd];
+    timer->cb_func = cb_func;
+    timer->expire = timer_now_ms() + 3 * m_timeslot * 1000;
+    m_users_timer[connfd].timer = timer;
+    m_timer_wheel.add_timer(timer);
+}
+
+void sub_reactor::refresh_timer(util_timer* timer) {
+    if (timer) {
+        timer->expire = timer_now_ms() + 3 * m_timeslot * 1000;
+        m_timer_wheel.adjust_timer(timer);
+    }
+}
+
+void sub_reactor::close_connection(int sockfd) {
+    util_timer* timer = m_users_timer[sockfd].timer;
+    if (timer) {
+        timer->cb_func(&m_users_timer[sockfd]);
+        m_timer_wheel.del_timer(timer);
+    }
+}
+
+void sub_reactor::run() {
+    epoll_event* events = new epoll_event[MAX_EVENT_NUMBER];
+
+    while (!m_stop) {
+
+        // 以时间轮上最近的到期时间作为 epoll_wait 超时, 驱动定时器
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, m_timer_wheel.wait_timeout());
+        if (number < 0 && errno != EINTR) {
+            LOG_ERROR("reactor %d %s", m_id, "epoll failure");
+            break;
+        }
+
+        for (int i = 0; i < number; i++) {
+            int sockfd = events[i].data.fd;
+
+            // 主线程分发了新连接
+            if (sockfd == m_wakeupfd) {
+                handle_pending();
+            }
+
+            // 本反应堆的 reuseport 监听套接字上有新连接
+            else if (sockfd == m_listenfd) {
+                handle_accept();
+            }
+
+            // 处理异常事件
+            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                close_connection(sockfd);
+            }
+
+            // 读取数据后直接在本线程解析并生成响应
+            else if (events[i].events & EPOLLIN) {
+                if ((*m_users)[sockfd].read_once()) {
+                    LOG_DEBUG(
+                        "reactor %d deal with the client(%s)", m_id,
+                        inet_ntoa((*m_users)[sockfd].get_address()->sin_addr));
+                    (*m_users)[sockfd].set_busy();
+                    (*m_users)[sockfd].process();
+                    refresh_timer(m_users_timer[sockfd].timer);
+                }
+                else {
+                    close_connection(sockfd);
+                }
+            }
+
+            else if (events[i].events & EPOLLOUT) {
+                if ((*m_users)[sockfd].write()) {
+                    LOG_DEBUG(
+                        "reactor %d send data to the client(%s)", m_id,
+                        inet_ntoa((*m_users)[sockfd].get_address()->sin_addr));
+
+                    // 缓冲区中还有流水线发来的请求, 直接在本线程继续处理
+                    if ((*m_users)[sockfd].has_pipelined_request()) {
+                        (*m_users)[sockfd].set_busy();
+                        (*m_users)[sockfd].process();
+                    }
+                    refresh_timer(m_users_timer[sockfd].timer);
+                }
+                else {
+                    close_connection(sockfd);
+                }
+            }
+        }
+
+        if (m_timer_wheel.wait_timeout() == 0) {
+            m_timer_wheel.tick();
+        }
+    }
+    delete[] events;
+}
+
+sub_reactor_pool::sub_reactor_pool(
+    int reactor_number, DISPATCH_MODE mode, http_conn_table* users, client_data* users_timer,
+    int timeslot, int max_fd)
+    : m_reactor_number(reactor_number), m_mode(mode), m_reactors(NULL), m_next(0) {
+
+    if (reactor_number <= 0) {
+        throw std::exception();
+    }
+
+    m_reactors = new sub_reactor*[m_reactor_number];
+    for (int i = 0; i < m_reactor_number; ++i) {
+        m_reactors[i] = new sub_reactor(i, users, users_timer, timeslot, max_fd);
+    }
+}
+
+bool sub_reactor_pool::listen_reuseport(int port, int backlog, bool cpu_affinity) {
+    int first_listenfd = -1;
+
+    // 按顺序 listen, reuseport 组内第 i 个套接字即第 i 个子反应堆的监听套接字
+    for (int i = 0; i < m_reactor_number; ++i) {
+        int listenfd = m_reactors[i]->listen_reuseport(port, backlog);
+        if (listenfd < 0) {
+            LOG_ERROR("reactor %d listen reuseport failed, errno is:%d", i, errno);
+            return false;
+        }
+        if (i == 0) {
+            first_listenfd = listenfd;
+        }
+    }
+
+    if (!cpu_affinity) {
+        return true;
+    }
+
+    int cpu_number = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < m_reactor_number; ++i) {
+        m_reactors[i]->set_cpu(i % cpu_number);
+    }
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    // BPF 程序返回处理 SYN 的 CPU 编号, 作为 reuseport 组内套接字下标
+    // 子反应堆数与 CPU 数不一致时, 超出范围的下标由内核退回到哈希选择
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (__u32)(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(first_listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) <
+        0) {
+        LOG_WARN("attach reuseport cpu bpf failed, errno is:%d", errno);
+    }
+#endif
+    return true;
+}
+
+void sub_reactor_pool::start() {
+    for (int i = 0; i < m_reactor_number; ++i) {
+        m_reactors[i]->start();
+    }
+}
+
+sub_reactor_pool::~sub_reactor_pool() {
+    for (int i = 0; i < m_reactor_number; ++i) {
+        m_reactors[i]->stop();
+        delete m_reactors[i];
+    }
+    delete[] m_reactors;
+}
+
+bool sub_reactor_pool::dispatch(int connfd, const sockaddr_in& address) {
+    return next_reactor()->add_connection(connfd, address);
+}
+
+sub_reactor* sub_reactor_pool::next_reactor() {
+    if (m_mode == LEAST_LOAD) {
+        sub_reactor* target = m_reactors[0];
+        for (int i = 1; i < m_reactor_number; ++i) {
+            if (m_reactors[i]->load() < target->load()) {
+                target = m_reactors[i];
+            }
+        }
+        return target;
+    }
+    return m_reactors[m_next++ % m_reactor_number];
+}
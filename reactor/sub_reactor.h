@@ -0,0 +1,142 @@
+/**
+ * @file sub_reactor.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 多 Reactor 模式(one loop per thread)
+ * 主线程只负责 accept, 新连接按轮询或最小负载分发给子反应堆,
+ * 每个子反应堆线程拥有独立的 epoll 内核事件表和时间轮, 自行完成读、解析与写
+ * 也可以让每个子反应堆各自打开 SO_REUSEPORT 监听套接字, 由内核把新连接分散到各线程
+ * @version 0.1
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef SUB_REACTOR_H
+#define SUB_REACTOR_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <list>
+
+#include "../http/http_conn.h"
+#include "../lock/locker.h"
+#include "../timer/time_wheel.h"
+
+// 子反应堆: 一个线程 + 一个 epoll 内核事件表 + 一个时间轮
+class sub_reactor {
+public:
+    static const int MAX_EVENT_NUMBER = 10000; // 单次 epoll_wait 最大事件数
+
+    // users 与 users_timer 为主线程分配的以 fd 为下标的连接表和数组,
+    // 子反应堆只访问分发给自己的 fd 对应的那一部分
+    sub_reactor(
+        int id, http_conn_table* users, client_data* users_timer, int timeslot, int max_fd);
+
+    ~sub_reactor();
+
+    // 打开本反应堆独占的 SO_REUSEPORT 监听套接字, 需在 start 之前调用
+    int listen_reuseport(int port, int backlog);
+
+    // 事件循环线程绑定到指定 CPU, 需在 start 之前调用
+    void set_cpu(int cpu) { m_cpu = cpu; }
+
+    // 创建事件循环线程
+    void start();
+
+    // 通知事件循环退出并回收线程
+    void stop();
+
+    // 由主线程调用, 把新连接交给本反应堆, 通过 eventfd 唤醒事件循环
+    bool add_connection(int connfd, const sockaddr_in& address);
+
+    // 当前负责的连接数, 供最小负载分发使用
+    int load() const { return m_load.load(std::memory_order_relaxed); }
+
+    int id() const { return m_id; }
+
+private:
+    // 新连接在主线程与子反应堆之间传递的结构
+    struct pending_conn {
+        int         connfd;
+        sockaddr_in address;
+    };
+
+    static void* worker(void* arg);
+
+    // 事件循环
+    void run();
+
+    // 取出主线程分发过来的新连接, 注册到本反应堆
+    void handle_pending();
+
+    // 在本反应堆的监听套接字上接受新连接
+    void handle_accept();
+
+    // 初始化连接对应的 http 对象和定时器
+    void register_connection(int connfd, const sockaddr_in& address);
+
+    // 有数据传输, 延后定时器
+    void refresh_timer(util_timer* timer);
+
+    // 关闭连接并删除定时器
+    void close_connection(int sockfd);
+
+    // 定时器回调函数, 只会在所属子反应堆线程中被调用
+    static void cb_func(client_data* user_data);
+
+private:
+    int              m_id;
+    int              m_epollfd;  // 本反应堆的内核事件表
+    int              m_wakeupfd; // eventfd, 主线程分发新连接后唤醒事件循环
+    int              m_listenfd; // SO_REUSEPORT 监听套接字, 未开启时为 -1
+    int              m_timeslot; // 最小超时单位
+    int              m_max_fd;   // users 表大小, 即最大连接数
+    int              m_cpu;      // 绑定的 CPU, -1 表示不绑定
+    pthread_t        m_thread;
+    volatile bool    m_stop;
+    http_conn_table* m_users;
+    client_data*     m_users_timer;
+    time_wheel       m_timer_wheel; // 本反应堆独立的时间轮
+    std::atomic<int> m_load;        // 当前负责的连接数
+
+    locker                  m_pending_locker; // 保护待注册连接队列
+    std::list<pending_conn> m_pending;        // 主线程分发过来的待注册连接
+};
+
+// 子反应堆池, 主线程(acceptor)通过它分发新连接
+class sub_reactor_pool {
+public:
+    // 新连接分发策略
+    enum DISPATCH_MODE { ROUND_ROBIN = 0, LEAST_LOAD };
+
+    sub_reactor_pool(
+        int reactor_number, DISPATCH_MODE mode, http_conn_table* users, client_data* users_timer,
+        int timeslot, int max_fd);
+
+    ~sub_reactor_pool();
+
+    // 每个子反应堆各开一个 SO_REUSEPORT 监听套接字, 需在 start 之前调用
+    // cpu_affinity 为 true 时, 第 i 个子反应堆绑定到第 i 个 CPU,
+    // 并在监听组上挂载按当前 CPU 选择套接字的 BPF 程序, 使连接在收到 SYN 的 CPU 上处理
+    bool listen_reuseport(int port, int backlog, bool cpu_affinity);
+
+    // 启动所有子反应堆的事件循环
+    void start();
+
+    // 把新连接交给一个子反应堆
+    bool dispatch(int connfd, const sockaddr_in& address);
+
+private:
+    // 按分发策略选出子反应堆
+    sub_reactor* next_reactor();
+
+private:
+    int           m_reactor_number;
+    DISPATCH_MODE m_mode;
+    sub_reactor** m_reactors;
+    unsigned int  m_next; // 轮询下标, 只由主线程访问
+};
+
+#endif
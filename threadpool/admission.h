@@ -0,0 +1,59 @@
+/**
+ * @file admission.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 按排队时间判断过载的准入控制
+ * 仿照 CoDel: 工作线程取出请求时报告排队时间, 排队时间在一个 interval 内始终高于 target,
+ * 说明队列不是短暂的突发而是持续积压, 判为过载; 之后有请求的排队时间回到 target 以下,
+ * 或队列被取空时解除过载
+ * @version 0.1
+ * @date 2023-03-31
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+class admission_control {
+public:
+    // target_ms 为可以接受的排队时间, interval_ms 为判定持续积压的观察时间
+    admission_control(int target_ms, int interval_ms)
+        : m_target_ns((int64_t)target_ms * 1000000), m_interval_ns((int64_t)interval_ms * 1000000),
+          m_above_until(0), m_overloaded(false) {}
+
+    // 工作线程取出请求时调用, sojourn_ns 为排队时间, empty 表示队列已取空
+    // 多个工作线程同时调用时只可能使判定提前或推后一个请求, 不需要加锁
+    void on_dequeue(int64_t sojourn_ns, int64_t now_ns, bool empty) {
+        if (sojourn_ns < m_target_ns || empty) {
+            m_above_until.store(0, std::memory_order_relaxed);
+            if (m_overloaded.load(std::memory_order_relaxed)) {
+                m_overloaded.store(false, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        // 排队时间第一次高于 target, 开始观察
+        int64_t until = m_above_until.load(std::memory_order_relaxed);
+        if (until == 0) {
+            m_above_until.store(now_ns + m_interval_ns, std::memory_order_relaxed);
+        }
+        else if (now_ns >= until && !m_overloaded.load(std::memory_order_relaxed)) {
+            m_overloaded.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // 是否过载, 过载时新请求应被拒绝
+    bool overloaded() const { return m_overloaded.load(std::memory_order_relaxed); }
+
+private:
+    const int64_t        m_target_ns;
+    const int64_t        m_interval_ns;
+    std::atomic<int64_t> m_above_until; // 观察结束的时刻, 0 表示排队时间低于 target
+    std::atomic<bool>    m_overloaded;
+};
+
+#endif
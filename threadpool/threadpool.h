@@ -13,27 +13,47 @@
 
 #include <pthread.h>
 
+#include <atomic>
 #include <cstdio>
 #include <exception>
-#include <list>
 
-#include "../CGImysql/sql_connection_pool.h"
 #include "../lock/locker.h"
-
-template <typename T>
+#include "../metrics/metrics.h"
+#include "admission.h"
+#include "work_queue.h"
+
+// Queue 为请求队列策略, 默认为互斥锁 + 链表,
+// 可换成无锁环形队列 ring_work_queue<T> 或工作窃取队列 stealing_work_queue<T>
+// T 需提供 set_queued_ns/queued_ns 保存入队时间, 用于统计排队时间
+template <typename T, typename Queue = list_work_queue<T> >
 class threadpool {
 public:
     // 构造函数
     // *thread_number是线程池中线程的数量
     // max_requests是请求队列中最多允许的等待处理的请求的数量
-    threadpool(connection_pool* connPool, int thread_number = 8, int max_request = 10000);
+    // target_ms、interval_ms 为准入控制可以接受的排队时间和判定持续积压的观察时间
+    threadpool(
+        int thread_number = 8, int max_request = 10000, int target_ms = 5, int interval_ms = 100);
 
     // 析构函数
     ~threadpool();
 
-    // 向任务队列插入任务
+    // 向任务队列插入任务, 队列已满或过载时返回 false, 由调用方拒绝该请求
     bool append(T* request);
 
+    // 排队时间持续高于 target, 且队列中仍有请求
+    bool overloaded() {
+        return m_admission.overloaded() && m_pending.load(std::memory_order_relaxed) > 0;
+    }
+
+    // 当前排队的任务数
+    int queue_size() { return m_workqueue.size(); }
+
+    // 请求队列, 用于读取队列策略自身的统计信息
+    Queue* get_queue() { return &m_workqueue; }
+
+    int thread_number() const { return m_thread_number; }
+
 private:
     // 工作线程运行的函数
     // 它不断从工作队列中取出任务并执行之
@@ -45,21 +65,26 @@ private:
     int              m_thread_number; // 线程池中的线程数
     int              m_max_requests;  // 请求队列中允许的最大请求数
     pthread_t*       m_threads;       // 描述线程池的数组，其大小为 m_thread_number
-    std::list<T*>    m_workqueue;     // 双向链表实现请求队列
-    locker           m_queuelocker;   // 保护请求队列的互斥锁
-    sem              m_queuestat;     // 是否有任务需要处理的信号量
+    Queue            m_workqueue;     // 请求队列
+    std::atomic<int> m_worker_id;     // 为工作线程分配编号
     bool             m_stop;          // 是否结束线程
-    connection_pool* m_connPool;      // 数据库连接池指针
+
+    admission_control m_admission; // 按排队时间判断过载
+    std::atomic<int>  m_pending;   // 已入队尚未取出的请求数, 判断队列是否取空
 };
 
 // 构造函数
-template <typename T>
-threadpool<T>::threadpool(connection_pool* connPool, int thread_number, int max_requests)
+template <typename T, typename Queue>
+threadpool<T, Queue>::threadpool(
+    int thread_number, int max_requests, int target_ms, int interval_ms)
     : m_thread_number(thread_number)
     , m_max_requests(max_requests)
-    , m_stop(false)
     , m_threads(NULL)
-    , m_connPool(connPool) {
+    , m_workqueue(thread_number, max_requests)
+    , m_worker_id(0)
+    , m_stop(false)
+    , m_admission(target_ms, interval_ms)
+    , m_pending(0) {
 
     if (thread_number <= 0 || max_requests <= 0) {
         throw std::exception();
@@ -88,55 +113,57 @@ threadpool<T>::threadpool(connection_pool* connPool, int thread_number, int max_
 }
 
 // 析构函数
-template <typename T>
-threadpool<T>::~threadpool() {
+template <typename T, typename Queue>
+threadpool<T, Queue>::~threadpool() {
     delete[] m_threads;
     m_stop = true;
 }
 
 // 向任务队列插入任务
-template <typename T>
-bool threadpool<T>::append(T* request) {
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests) {
-        m_queuelocker.unlock();
+template <typename T, typename Queue>
+bool threadpool<T, Queue>::append(T* request) {
+    // 过载时不再入队, 排在后面只会等得更久; 队列取空后总是接受, 使过载判定能够解除
+    if (overloaded()) {
+        return false;
+    }
+
+    // 超过 m_max_requests 时由队列策略拒绝
+    request->set_queued_ns(metrics::now_ns());
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    if (!m_workqueue.push(request)) {
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
         return false;
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post(); // 信号量 + 1, 通知有任务要处理
     return true;
 }
 
 // 工作线程运行
-template <typename T>
-void* threadpool<T>::worker(void* arg) {
+template <typename T, typename Queue>
+void* threadpool<T, Queue>::worker(void* arg) {
     threadpool* pool = (threadpool*)arg;
     pool->run();
     return pool;
 }
 
-template <typename T>
-void threadpool<T>::run() {
+template <typename T, typename Queue>
+void threadpool<T, Queue>::run() {
+    int worker = m_worker_id++; // 工作线程编号, 工作窃取模式下对应本地队列
     while (!m_stop) {
-        m_queuestat.wait(); // 等待信号量
-        m_queuelocker.lock();
-        if (m_workqueue.empty()) {
-            m_queuelocker.unlock();
-            continue;
-        }
-        T* request = m_workqueue.front(); // 从任务队列取任务
-        m_workqueue.pop_front();          // 将取出任务从任务队列中删除
-        m_queuelocker.unlock();
+        T* request = m_workqueue.pop(worker); // 从任务队列取任务, 队列为空时阻塞
         if (!request) {
             continue;
         }
+        int64_t now = metrics::now_ns();
+        int64_t sojourn = now - request->queued_ns();
+        metrics::record(metrics::QUEUE_WAIT, sojourn);
+        bool    empty = m_pending.fetch_sub(1, std::memory_order_relaxed) == 1;
+        m_admission.on_dequeue(sojourn, now, empty);
 
         // Proactor 模型
         // 主线程和内核负责处理读写数据、接受新连接等I/O操作
         // 工作线程仅负责业务逻辑
-        connectionRAII mysqlcon(&request->mysql, m_connPool); // 获取连接
-        request->process();                                   // 处理业务逻辑
+        // 需要访问数据库的请求由 http_conn 交给数据库线程, 工作线程不持有数据库连接
+        request->process(); // 处理业务逻辑
     }
 }
 
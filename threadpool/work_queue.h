@@ -0,0 +1,392 @@
+/**
+ * @file work_queue.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 线程池请求队列策略
+ * list_work_queue: 互斥锁 + 链表 + 信号量, 即原有实现
+ * ring_work_queue: 有界无锁多生产者多消费者环形队列
+ * stealing_work_queue: 每个工作线程一个本地队列, 空闲线程从忙碌线程窃取任务
+ * 队列策略需提供 (thread_number, max_requests) 构造函数、push(T*)
+ * 与阻塞的 pop(worker), 作为 threadpool 的模板参数
+ * @version 0.1
+ * @date 2023-03-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <list>
+
+#include "../lock/locker.h"
+
+#define CACHE_LINE_SIZE 64
+
+// 互斥锁保护的链表请求队列
+template <typename T>
+class list_work_queue {
+public:
+    // max_requests 是请求队列中最多允许的等待处理的请求的数量
+    list_work_queue(int /* thread_number */, int max_requests) : m_max_requests(max_requests) {}
+
+    // 向队列插入任务, 队列已满返回 false
+    bool push(T* request) {
+        m_queuelocker.lock();
+        if (m_workqueue.size() > m_max_requests) {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post(); // 信号量 + 1, 通知有任务要处理
+        return true;
+    }
+
+    // 取出任务, 队列为空时阻塞; 被唤醒但没有取到任务返回 NULL
+    T* pop(int /* worker */) {
+        m_queuestat.wait(); // 等待信号量
+        m_queuelocker.lock();
+        if (m_workqueue.empty()) {
+            m_queuelocker.unlock();
+            return NULL;
+        }
+        T* request = m_workqueue.front(); // 从任务队列取任务
+        m_workqueue.pop_front();          // 将取出任务从任务队列中删除
+        m_queuelocker.unlock();
+        return request;
+    }
+
+    // 当前排队的任务数
+    int size() {
+        m_queuelocker.lock();
+        int size = m_workqueue.size();
+        m_queuelocker.unlock();
+        return size;
+    }
+
+private:
+    int           m_max_requests; // 请求队列中允许的最大请求数
+    std::list<T*> m_workqueue;    // 双向链表实现请求队列
+    locker        m_queuelocker;  // 保护请求队列的互斥锁
+    sem           m_queuestat;    // 是否有任务需要处理的信号量
+};
+
+// 有界无锁 MPMC 环形队列, 每个槽位带序号(Dmitry Vyukov 算法)
+// 入队、出队各自只对一个下标做 CAS, 不分配内存;
+// 队首、队尾下标分别独占缓存行, 避免生产者与消费者之间的伪共享。
+// 只有当确实有工作线程睡眠时才 post 信号量, 忙碌时入队出队都不进入内核
+template <typename T>
+class ring_work_queue {
+public:
+    ring_work_queue(int /* thread_number */, int max_requests) : m_sleepers(0) {
+        if (max_requests <= 0) {
+            throw std::exception();
+        }
+
+        // 容量取不小于 max_requests 的 2 的幂, 以位与代替取模;
+        // 背压仍以 max_requests 为准
+        size_t capacity = 1;
+        while (capacity < (size_t)max_requests) {
+            capacity <<= 1;
+        }
+        m_mask = capacity - 1;
+        m_max_requests = max_requests;
+        m_cells = new cell[capacity];
+        for (size_t i = 0; i < capacity; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~ring_work_queue() { delete[] m_cells; }
+
+    // 向队列插入任务, 达到 max_requests 返回 false
+    bool push(T* request) {
+        if (!try_push(request)) {
+            return false;
+        }
+
+        // 与 pop 中登记睡眠者后的复查配对, 保证不会丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0) {
+            m_queuestat.post();
+        }
+        return true;
+    }
+
+    // 取出任务, 队列为空时阻塞
+    T* pop(int /* worker */) {
+        T* request = NULL;
+        while (!try_pop(request)) {
+            // 先自旋几次, 任务密集时无需进入内核
+            bool got = false;
+            for (int i = 0; i < SPIN_COUNT && !got; ++i) {
+                sched_yield();
+                got = try_pop(request);
+            }
+            if (got) {
+                break;
+            }
+
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (try_pop(request)) {
+                m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            m_queuestat.wait();
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return request;
+    }
+
+    // 当前排队的任务数(近似值)
+    int size() {
+        size_t enqueue_pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        return enqueue_pos > dequeue_pos ? (int)(enqueue_pos - dequeue_pos) : 0;
+    }
+
+private:
+    static const int SPIN_COUNT = 16;
+
+    struct cell {
+        std::atomic<size_t> sequence; // 槽位序号, 标识槽位可写还是可读
+        T*                  data;
+    };
+
+    bool try_push(T* request) {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            // 背压: 排队数达到上限即拒绝
+            // pos 可能已过时, 消费者已越过它时差值为负, 重新读取入队下标
+            intptr_t queued = (intptr_t)(pos - m_dequeue_pos.load(std::memory_order_acquire));
+            if (queued < 0) {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (queued >= m_max_requests) {
+                return false;
+            }
+            cell*    c = &m_cells[pos & m_mask];
+            size_t   seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                // 槽位可写, 抢占入队下标
+                if (m_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    c->data = request;
+                    c->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                // 槽位仍被上一轮占用, 队列已满
+                return false;
+            }
+            else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T*& request) {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell*    c = &m_cells[pos & m_mask];
+            size_t   seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                // 槽位可读, 抢占出队下标
+                if (m_dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    request = c->data;
+                    c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                // 队列为空
+                return false;
+            }
+            else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos; // 入队下标, 生产者独占缓存行
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos; // 出队下标, 消费者独占缓存行
+    alignas(CACHE_LINE_SIZE) cell* m_cells;                     // 环形数组
+    size_t           m_mask;
+    int              m_max_requests;
+    std::atomic<int> m_sleepers;  // 睡眠在信号量上的工作线程数
+    sem              m_queuestat; // 队列为空时工作线程在此睡眠
+};
+
+// 工作窃取队列
+// 每个工作线程拥有一个本地双端队列, 同一连接的请求固定投递给同一工作线程,
+// 保持连接对象在该线程缓存中的局部性; 本地队列为空时从其他工作线程的队尾窃取。
+// 各本地队列有各自的锁和缓存行, 工作线程之间不再争抢同一个队头
+template <typename T>
+class stealing_work_queue {
+public:
+    stealing_work_queue(int thread_number, int max_requests)
+        : m_thread_number(thread_number), m_max_requests(max_requests), m_total(0) {
+        if (thread_number <= 0 || max_requests <= 0) {
+            throw std::exception();
+        }
+        m_workers = new local_queue[m_thread_number];
+    }
+
+    ~stealing_work_queue() { delete[] m_workers; }
+
+    // 按连接投递到固定的工作线程
+    bool push(T* request) {
+        return push(request, (int)(((uintptr_t)request / sizeof(T)) % m_thread_number));
+    }
+
+    // 投递到指定工作线程的本地队列, 总排队数达到 max_requests 返回 false
+    bool push(T* request, int worker) {
+        if (m_total.fetch_add(1, std::memory_order_relaxed) >= m_max_requests) {
+            m_total.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        local_queue& q = m_workers[worker];
+        q.queuelocker.lock();
+        q.tasks.push_back(request);
+        q.depth.store(q.tasks.size(), std::memory_order_relaxed);
+        q.queuelocker.unlock();
+
+        // 与 pop 中标记睡眠后的复查配对, 保证不会丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (q.sleeping.load(std::memory_order_relaxed)) {
+            q.wakeup.post();
+        }
+        // 目标线程正忙, 唤醒一个空闲线程来窃取
+        else {
+            for (int i = 1; i < m_thread_number; ++i) {
+                local_queue& idle = m_workers[(worker + i) % m_thread_number];
+                if (idle.sleeping.load(std::memory_order_relaxed)) {
+                    idle.wakeup.post();
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    // 先取本地队列, 再窃取, 都没有任务时睡眠
+    T* pop(int worker) {
+        local_queue& q = m_workers[worker];
+        while (true) {
+            T* request = take(worker);
+            if (request) {
+                return request;
+            }
+
+            q.sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            request = take(worker);
+            if (request) {
+                q.sleeping.store(false, std::memory_order_relaxed);
+                return request;
+            }
+            q.wakeup.wait();
+            q.sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // 当前排队的任务总数
+    int size() { return m_total.load(std::memory_order_relaxed); }
+
+    // 指定工作线程本地队列的深度
+    int depth(int worker) { return m_workers[worker].depth.load(std::memory_order_relaxed); }
+
+    // 指定工作线程从其他线程窃取到的任务数
+    long steals(int worker) { return m_workers[worker].steals.load(std::memory_order_relaxed); }
+
+private:
+    // 工作线程的本地队列, 独占缓存行
+    struct alignas(CACHE_LINE_SIZE) local_queue {
+        local_queue() : depth(0), steals(0), sleeping(false) {}
+
+        locker            queuelocker;
+        std::deque<T*>    tasks;
+        std::atomic<int>  depth;    // 本地队列深度
+        std::atomic<long> steals;   // 窃取到的任务数
+        std::atomic<bool> sleeping; // 是否睡眠在 wakeup 上
+        sem               wakeup;
+    };
+
+    // 本地队列按先进先出取任务, 为空则从其他线程队尾窃取
+    T* take(int worker) {
+        T* request = pop_front(m_workers[worker]);
+        if (request) {
+            return request;
+        }
+        for (int i = 1; i < m_thread_number; ++i) {
+            request = pop_back(m_workers[(worker + i) % m_thread_number]);
+            if (request) {
+                m_workers[worker].steals.fetch_add(1, std::memory_order_relaxed);
+                return request;
+            }
+        }
+        return NULL;
+    }
+
+    T* pop_front(local_queue& q) {
+        // 先无锁检查, 空队列不加锁
+        if (q.depth.load(std::memory_order_relaxed) == 0) {
+            return NULL;
+        }
+        T* request = NULL;
+        q.queuelocker.lock();
+        if (!q.tasks.empty()) {
+            request = q.tasks.front();
+            q.tasks.pop_front();
+            q.depth.store(q.tasks.size(), std::memory_order_relaxed);
+        }
+        q.queuelocker.unlock();
+        if (request) {
+            m_total.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return request;
+    }
+
+    T* pop_back(local_queue& q) {
+        if (q.depth.load(std::memory_order_relaxed) == 0) {
+            return NULL;
+        }
+        T* request = NULL;
+        q.queuelocker.lock();
+        if (!q.tasks.empty()) {
+            request = q.tasks.back();
+            q.tasks.pop_back();
+            q.depth.store(q.tasks.size(), std::memory_order_relaxed);
+        }
+        q.queuelocker.unlock();
+        if (request) {
+            m_total.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return request;
+    }
+
+private:
+    int              m_thread_number;
+    int              m_max_requests;
+    std::atomic<int> m_total; // 所有本地队列的任务总数
+    local_queue*     m_workers;
+};
+
+#endif
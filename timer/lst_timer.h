@@ -15,6 +15,15 @@
 #include <time.h>
 
 #include "../log/log.h"
+#include "../memory/object_pool.h"
+
+// 定时器使用的时钟: 单调时钟, 毫秒
+// 不受系统时间调整影响, 超时精度为毫秒
+inline time_t timer_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 // 声明定时器类
 class util_timer;
@@ -23,6 +32,7 @@ class util_timer;
 struct client_data {
     sockaddr_in address; // 客户端 socket 地址
     int         sockfd;  // socket 文件描述符
+    int         epollfd; // 连接所属的内核事件表
     util_timer* timer;   // 定时器
 };
 
@@ -31,8 +41,16 @@ class util_timer {
 public:
     util_timer() : prev(NULL), next(NULL) {}
 
+    // 每个连接都要创建定时器, 从对象池分配, 避免每次 accept 都走一次 malloc
+    static void* operator new(size_t size) {
+        return object_pool<util_timer>::get_instance()->allocate();
+    }
+    static void operator delete(void* p) {
+        object_pool<util_timer>::get_instance()->deallocate(p);
+    }
+
 public:
-    time_t expire;                 // 超时时间
+    time_t expire;                 // 超时时间, timer_now_ms() 时钟下的毫秒数
     void (*cb_func)(client_data*); // 回调函数
     client_data* user_data;        // 用户数据
     util_timer*  prev;             // 指向前一个定时器
@@ -148,10 +166,9 @@ public:
             return;
         }
         // printf( "timer tick\n" );
-        LOG_INFO("%s", "timer tick");
-        Log::get_instance()->flush();
+        LOG_DEBUG("%s", "timer tick");
 
-        time_t      cur = time(NULL); // 获取系统当前时间
+        time_t      cur = timer_now_ms(); // 获取当前时间
         util_timer* tmp = head;
         while (tmp) {
 
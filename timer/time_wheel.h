@@ -0,0 +1,264 @@
+/**
+ * @file time_wheel.h
+ * @author Chang Chiang (Chang_Chiang@outlook.com)
+ * @brief 分层时间轮
+ * 与 sort_timer_lst 接口相同(add_timer/adjust_timer/del_timer/tick),
+ * 添加、调整、删除定时器均为 O(1), 不再随连接数线性增长。
+ * 滴答为 1 毫秒, 事件循环以 wait_timeout() 作为 epoll_wait 的超时时间,
+ * 只在最近的到期时间醒来, 不依赖进程级的 SIGALRM, 每个事件循环各用一个时间轮
+ * @version 0.1
+ * @date 2023-03-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TIME_WHEEL_H
+#define TIME_WHEEL_H
+
+#include <time.h>
+
+#include "../log/log.h"
+#include "lst_timer.h"
+
+// 分层时间轮, 共 WHEEL_LEVELS 层, 每层 WHEEL_SLOTS 个槽
+// 第 0 层每槽对应 1 个滴答, 第 i 层每槽对应 WHEEL_SLOTS^i 个滴答,
+// 低层转满一圈时把高层对应槽中的定时器重新分配到低层(cascade)。
+// 每个槽是带哨兵节点的双向循环链表, 复用 util_timer 的 prev/next 指针
+class time_wheel {
+public:
+    static const int WHEEL_BITS = 6;
+    static const int WHEEL_SLOTS = 1 << WHEEL_BITS; // 每层槽数
+    static const int WHEEL_MASK = WHEEL_SLOTS - 1;
+    static const int WHEEL_LEVELS = 4;              // 层数, 可表示 2^24 毫秒
+
+    time_wheel() : m_current(timer_now_ms()), m_count(0) {
+        for (int level = 0; level < WHEEL_LEVELS; ++level) {
+            for (int slot = 0; slot < WHEEL_SLOTS; ++slot) {
+                util_timer* head = &m_slots[level][slot];
+                head->prev = head;
+                head->next = head;
+            }
+        }
+    }
+
+    ~time_wheel() {
+        for (int level = 0; level < WHEEL_LEVELS; ++level) {
+            for (int slot = 0; slot < WHEEL_SLOTS; ++slot) {
+                util_timer* head = &m_slots[level][slot];
+                util_timer* tmp = head->next;
+                while (tmp != head) {
+                    util_timer* next = tmp->next;
+                    delete tmp;
+                    tmp = next;
+                }
+            }
+        }
+    }
+
+    // 按超时时间放入对应层的槽
+    void add_timer(util_timer* timer) {
+        if (!timer) {
+            return;
+        }
+
+        // 空闲期间没有 tick, m_current 停在上次处理的时刻, 先对齐到当前时间
+        if (m_count == 0) {
+            m_current = timer_now_ms();
+        }
+        link(slot_of(timer->expire), timer);
+        ++m_count;
+    }
+
+    // 超时时间变化后, 从原槽取出放入新槽
+    void adjust_timer(util_timer* timer) {
+        if (!timer) {
+            return;
+        }
+        unlink(timer);
+        link(slot_of(timer->expire), timer);
+    }
+
+    // 从时间轮中删除定时器
+    void del_timer(util_timer* timer) {
+        if (!timer) {
+            return;
+        }
+        unlink(timer);
+        delete timer;
+        --m_count;
+    }
+
+    // 推进时间轮到当前时间, 执行期间所有到期定时器的回调
+    void tick() {
+        time_t cur = timer_now_ms();
+        while (m_current <= cur) {
+            // 没有定时器时直接跳到当前时间
+            if (m_count == 0) {
+                m_current = cur + 1;
+                break;
+            }
+
+            int index = m_current & WHEEL_MASK;
+
+            // 当前槽为空时跳到下一个需要处理的时刻, 不逐毫秒空转
+            // next_expire 包括高层槽开始 cascade 的时刻, 跳过的区间内没有需要处理的槽
+            if (m_slots[0][index].next == &m_slots[0][index]) {
+                time_t next = next_expire();
+                if (next > m_current) {
+                    if (next > cur) {
+                        m_current = cur + 1;
+                        break;
+                    }
+                    m_current = next;
+                    index = m_current & WHEEL_MASK;
+                }
+            }
+
+            // 第 0 层转满一圈, 逐层把高层的槽重新分配下来
+            if (index == 0) {
+                for (int level = 1; level < WHEEL_LEVELS; ++level) {
+                    int slot = (m_current >> (level * WHEEL_BITS)) & WHEEL_MASK;
+                    cascade(level, slot);
+                    if (slot != 0) {
+                        break;
+                    }
+                }
+            }
+
+            // 取下当前槽的整条链表再逐个处理, 回调中增删定时器不影响遍历
+            util_timer* head = &m_slots[0][index];
+            util_timer  expired;
+            splice(head, &expired);
+
+            util_timer* tmp = expired.next;
+            while (tmp != &expired) {
+                util_timer* next = tmp->next;
+                tmp->prev = tmp->next = NULL;
+
+                // 执行定时任务后删除定时器
+                tmp->cb_func(tmp->user_data);
+                delete tmp;
+                --m_count;
+                tmp = next;
+            }
+            ++m_current;
+        }
+    }
+
+    // 距离下一次需要 tick 的毫秒数, 作为 epoll_wait 的超时时间
+    // 没有定时器时返回 -1, 即一直阻塞到有事件发生
+    int wait_timeout() {
+        time_t next = next_expire();
+        if (next < 0) {
+            return -1;
+        }
+        time_t cur = timer_now_ms();
+        return next > cur ? (int)(next - cur) : 0;
+    }
+
+    // 当前定时器数量
+    int size() const { return m_count; }
+
+private:
+    // 下一次需要处理的时刻: 第 0 层最近的非空槽, 或高层最近的非空槽开始 cascade 的时刻
+    // 高层槽只给出下界, 醒来 cascade 后再得到更精确的时间
+    time_t next_expire() {
+        if (m_count == 0) {
+            return -1;
+        }
+
+        time_t next = -1;
+        for (int level = 0; level < WHEEL_LEVELS; ++level) {
+            int    shift = level * WHEEL_BITS;
+            time_t base = m_current >> shift;
+
+            // 第 0 层从当前槽开始找; 高层当前下标对应的槽已经 cascade 过, 要等转完一圈,
+            // 但 m_current 恰好落在该槽的起点时还没有 cascade, 也从当前槽开始找
+            int first = (m_current & (((time_t)1 << shift) - 1)) == 0 ? 0 : 1;
+            for (int offset = first; offset < first + WHEEL_SLOTS; ++offset) {
+                util_timer* head = &m_slots[level][(base + offset) & WHEEL_MASK];
+                if (head->next != head) {
+                    time_t start = (base + offset) << shift;
+                    if (start < m_current) {
+                        start = m_current;
+                    }
+                    if (next < 0 || start < next) {
+                        next = start;
+                    }
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    // 计算超时时间所在的槽
+    util_timer* slot_of(time_t expire) {
+        // 已经超时的定时器放入当前槽, 下次 tick 即处理
+        if (expire < m_current) {
+            expire = m_current;
+        }
+
+        time_t delta = expire - m_current;
+        for (int level = 0; level < WHEEL_LEVELS; ++level) {
+            if (delta < ((time_t)1 << ((level + 1) * WHEEL_BITS))) {
+                return &m_slots[level][(expire >> (level * WHEEL_BITS)) & WHEEL_MASK];
+            }
+        }
+
+        // 超出时间轮范围, 先放在最高层的最远槽, cascade 时再按实际时间分配
+        expire = m_current + ((time_t)1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+        int level = WHEEL_LEVELS - 1;
+        return &m_slots[level][(expire >> (level * WHEEL_BITS)) & WHEEL_MASK];
+    }
+
+    // 把高层槽中的定时器按剩余时间重新放入时间轮
+    void cascade(int level, int slot) {
+        util_timer pending;
+        splice(&m_slots[level][slot], &pending);
+
+        util_timer* tmp = pending.next;
+        while (tmp != &pending) {
+            util_timer* next = tmp->next;
+            link(slot_of(tmp->expire), tmp);
+            tmp = next;
+        }
+    }
+
+    // 插入到槽链表尾部
+    static void link(util_timer* head, util_timer* timer) {
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    // 从所在槽链表中摘下
+    static void unlink(util_timer* timer) {
+        if (timer->prev && timer->next) {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+    }
+
+    // 把 head 槽中的整条链表转移到 to 上, head 置空
+    static void splice(util_timer* head, util_timer* to) {
+        if (head->next == head) {
+            to->prev = to->next = to;
+            return;
+        }
+        to->next = head->next;
+        to->prev = head->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        head->prev = head->next = head;
+    }
+
+private:
+    time_t     m_current;                           // 时间轮当前滴答, 即下一个待处理的毫秒
+    int        m_count;                             // 定时器数量
+    util_timer m_slots[WHEEL_LEVELS][WHEEL_SLOTS]; // 各槽的哨兵节点
+};
+
+#endif